@@ -1,12 +1,17 @@
+#define _GNU_SOURCE
 #include<stdio.h>
 #include<stdlib.h>
 #include<assert.h>
 #include<string.h>
+#include<limits.h>
+#include<float.h>
 #include<fcntl.h>
 #include<ctype.h>
 #include<unistd.h>
 #include<sys/types.h>
 #include<sys/stat.h>
+#include<sys/mman.h>
+#include<sys/uio.h>
 
 #include"bplustree.h"
 
@@ -56,6 +61,24 @@ key和data的个数由_max_entries决定：_max_entries = (_block_size - sizeof(
 /*16位数据宽度*/
 #define ADDR_STR_WIDTH 16
 
+/*顺序扫描预读窗口的初始和最大叶子节点个数*/
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 64
+
+/*批量查找每组预读的节点个数*/
+#define BATCH_PREFETCH 32
+
+/*O_DIRECT模式下缓存的对齐字节数和区块的最小字节数*/
+#define DIRECT_IO_ALIGN 4096
+#define DIRECT_IO_MIN_BLOCK 512
+
+/*只写修改过的部分时的扇区字节数，O_DIRECT模式按DIRECT_IO_ALIGN对齐*/
+#define PARTIAL_WRITE_SECTOR 512
+
+/*.index预分配的初始区块个数和每次预分配的最大字节数，每次预分配后大小加倍*/
+#define PREALLOC_MIN_BLOCKS 16
+#define PREALLOC_MAX_BYTES (16 << 20)
+
 /*B+树节点node末尾的偏移地址，即key的首地址*/
 #define offset_ptr(node) ((char *) (node) + sizeof(*node))
 
@@ -68,6 +91,22 @@ key和data的个数由_max_entries决定：_max_entries = (_block_size - sizeof(
 /*返回最后一个key的指针，用于非叶子节点的指向，即第一个ptr*/
 #define sub(node) ((off_t *)(offset_ptr(node) + (_max_order - 1) * sizeof(key_t)))
 
+/*返回最后一个ptr之后的地址，强制转换为long*，即每个分支的键值个数，只在BPLUS_TREE_COUNTS模式下存在*/
+#define count(node) ((long *)(sub(node) + _max_order))
+
+/*
+叶子节点扫描内核使用的向量类型，GCC向量扩展，SIMD_LANES为一个向量中long的个数
+只在有64位有符号比较指令时使用：AVX2(-mavx2)每次4个，SSE4.2(-msse4.2)每次2个
+只有SSE2时64位比较由多条指令模拟，实测比逐个比较慢，不使用向量，内核只有逐个处理的部分
+*/
+#if defined(__AVX2__)
+typedef long vec_long __attribute__((vector_size(32)));
+#define SIMD_LANES ((int) (sizeof(vec_long) / sizeof(long)))
+#elif defined(__SSE4_2__)
+typedef long vec_long __attribute__((vector_size(16)));
+#define SIMD_LANES ((int) (sizeof(vec_long) / sizeof(long)))
+#endif
+
 /*
 全局静态变量
 _block_size--------------------每个节点的大小(容量要包含1个node和3个及以上的key，data)
@@ -77,6 +116,8 @@ _max_order---------------------非叶子节点内最大关键字个数
 static int _block_size;
 static int _max_entries;
 static int _max_order;
+/*已打开的B+树个数，节点布局是全局的，同时打开的B+树必须使用相同的布局*/
+static int _open_trees;
 
 /*
 判断是否为叶子节点
@@ -87,25 +128,52 @@ static inline int is_leaf(struct bplus_node *node)
 }
 
 /*
-键值二分查找
+插值查找，最多INTERP_MAX_PROBES次按键值比例估计位置，缩小的范围内再二分查找
+int *probes-------------------累加比较的次数
+返回--------------------------和二分查找相同
 */
-static int key_binary_search(struct bplus_node *node, key_t target)
+static int key_interpolation_search(key_t *arr, int len, key_t target, int *probes)
 {
-        key_t *arr = key(node);
-		/*叶子节点：len；非叶子节点：len-1;非叶子节点的key少一个，用于放ptr*/
-        int len = is_leaf(node) ? node->children : node->children - 1;
-        int low = -1;
-        int high = len;
+        int lo = 0, hi = len - 1, n = 0;
+
+        /*目标在arr[lo]和arr[hi]之间时才能按比例估计*/
+        while (lo <= hi && n < INTERP_MAX_PROBES) {
+                if (target < arr[lo]) {
+                        *probes += n + 1;
+                        return -lo - 1;
+                }
+                if (target > arr[hi]) {
+                        *probes += n + 2;
+                        return -(hi + 1) - 1;
+                }
+                int pos = lo;
+                if (arr[hi] != arr[lo]) {
+                        pos += (int) (((double) target - arr[lo]) * (hi - lo) / ((double) arr[hi] - arr[lo]));
+                }
+                n++;
+                if (arr[pos] == target) {
+                        *probes += n;
+                        return pos;
+                } else if (arr[pos] < target) {
+                        lo = pos + 1;
+                } else {
+                        hi = pos - 1;
+                }
+        }
 
+        /*剩下的范围二分查找，arr[lo-1] < target < arr[hi+1]*/
+        int low = lo - 1;
+        int high = hi + 1;
         while (low + 1 < high) {
                 int mid = low + (high - low) / 2;
+                n++;
                 if (target > arr[mid]) {
                         low = mid;
                 } else {
                         high = mid;
                 }
         }
-
+        *probes += n;
         if (high >= len || arr[high] != target) {
                 return -high - 1;
         } else {
@@ -113,15 +181,87 @@ static int key_binary_search(struct bplus_node *node, key_t target)
         }
 }
 
+/*
+键值查找
+按mode选择二分查找或插值查找，BPLUS_SEARCH_AUTO时由节点的第一个、最后一个键值和个数决定：
+键值足够多并且平均间隔不超过INTERP_MAX_GAP时认为键值是稠密均匀的，使用插值查找
+struct bplus_search_stats *stats---累加查找次数和比较次数，为NULL时不统计
+*/
+static int key_search(struct bplus_node *node, key_t target, int mode, struct bplus_search_stats *stats)
+{
+        key_t *arr = key(node);
+		/*叶子节点：len；非叶子节点：len-1;非叶子节点的key少一个，用于放ptr*/
+        int len = is_leaf(node) ? node->children : node->children - 1;
+        int low = -1;
+        int high = len;
+        int probes = 0, ret;
+
+        int interpolation = mode != BPLUS_SEARCH_BINARY && len >= INTERP_MIN_KEYS &&
+                            (mode == BPLUS_SEARCH_INTERPOLATION ||
+                             (double) arr[len - 1] - arr[0] <= (double) INTERP_MAX_GAP * (len - 1));
+
+        if (interpolation) {
+                ret = key_interpolation_search(arr, len, target, &probes);
+        } else {
+                while (low + 1 < high) {
+                        int mid = low + (high - low) / 2;
+                        probes++;
+                        if (target > arr[mid]) {
+                                low = mid;
+                        } else {
+                                high = mid;
+                        }
+                }
+
+                if (high >= len || arr[high] != target) {
+                        ret = -high - 1;
+                } else {
+                        ret = high;
+                }
+        }
+
+        if (stats != NULL) {
+                stats->searches++;
+                stats->interpolations += interpolation;
+                stats->probes += probes;
+                stats->histogram[probes < SEARCH_PROBE_HIST ? probes : SEARCH_PROBE_HIST - 1]++;
+        }
+        return ret;
+}
+
+/*
+写线程中的键值查找，使用B+树的查找方式并计入B+树的统计信息
+其他线程中的读取(快照、并行扫描)直接调用key_search，不统计
+*/
+static inline int key_binary_search(struct bplus_tree *tree, struct bplus_node *node, key_t target)
+{
+        return key_search(node, target, tree->search_mode, &tree->search_stats);
+}
+
 /*
 查找键值在父节点的第几位
 */
-static inline int parent_key_index(struct bplus_node *parent, key_t key)
+static inline int parent_key_index(struct bplus_tree *tree, struct bplus_node *parent, key_t key)
 {
-        int index = key_binary_search(parent, key);
+        int index = key_binary_search(tree, parent, key);
         return index >= 0 ? index : -index - 2;
 }
 
+/*
+查找子节点在父节点的第几个分支
+不依赖子节点的键值，子节点为空时也能使用
+*/
+static inline int parent_sub_index(struct bplus_node *parent, off_t offset)
+{
+        int i;
+        for (i = 0; i < parent->children; i++) {
+                if (sub(parent)[i] == offset) {
+                        return i;
+                }
+        }
+        assert(0);
+}
+
 /*
 占用缓存区，与cache_defer对应
 占用内存，以供使用
@@ -224,6 +364,96 @@ static struct bplus_node *node_seek(struct bplus_tree *tree, off_t offset)
         assert(0);
 }
 
+/*
+找到最左边的叶子节点，沿叶子节点链表可以顺序读取全部数据
+返回--------------------------node_seek读取的叶子节点，空树返回NULL
+*/
+static struct bplus_node *leaf_first(struct bplus_tree *tree)
+{
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL && !is_leaf(node)) {
+                node = node_seek(tree, sub(node)[0]);
+        }
+        return node;
+}
+
+/*
+在.index末尾分配一个区块
+超出已预分配的空间时，按区段预分配，避免每个区块都扩展文件
+区段从PREALLOC_MIN_BLOCKS个区块开始加倍，最大PREALLOC_MAX_BYTES
+文件系统不支持fallocate时不再预分配
+*/
+static off_t block_append(struct bplus_tree *tree)
+{
+        off_t offset = tree->file_size;
+        tree->file_size += _block_size;
+        if (tree->file_size > tree->alloc_size && tree->extent > 0) {
+                if (fallocate(tree->fd, 0, tree->alloc_size, tree->extent) == 0) {
+                        tree->alloc_size += tree->extent;
+                        if (tree->extent < PREALLOC_MAX_BYTES) {
+                                tree->extent *= 2;
+                        }
+                } else {
+                        tree->extent = 0;
+                }
+        }
+        return offset;
+}
+
+/*
+在快照的页表中查找区块
+*/
+static struct snapshot_page *snapshot_page_find(struct bplus_snapshot *snap, off_t offset)
+{
+        struct snapshot_page *page = snap->pages[(offset / _block_size) % SNAPSHOT_HASH_SIZE];
+        while (page != NULL && page->offset != offset) {
+                page = page->next;
+        }
+        return page;
+}
+
+/*
+写时复制：区块被覆盖之前，为还没有保存该区块的快照保存旧内容
+旧内容写到.index末尾新分配的区块，不从空闲区块链表分配，空闲区块可能仍被快照引用
+同时需要旧内容的快照共享同一个副本，引用计数为0时回收
+快照创建之后才分配的区块不在快照中，不需要保存
+*/
+static void snapshot_preserve(struct bplus_tree *tree, off_t offset)
+{
+        struct snapshot_copy *copy = NULL;
+        struct list_head *pos;
+
+        pthread_mutex_lock(&tree->snap_lock);
+        list_for_each(pos, &tree->snapshots) {
+                struct bplus_snapshot *snap = list_entry(pos, struct bplus_snapshot, link);
+                if (offset >= snap->file_size || snapshot_page_find(snap, offset) != NULL) {
+                        continue;
+                }
+
+                /*第一个需要的快照复制旧内容*/
+                if (copy == NULL) {
+                        copy = malloc(sizeof(*copy));
+                        assert(copy != NULL);
+                        copy->offset = block_append(tree);
+                        copy->refs = 0;
+                        int len = pread(tree->fd, tree->snap_buf, _block_size, offset);
+                        assert(len == _block_size);
+                        len = pwrite(tree->fd, tree->snap_buf, _block_size, copy->offset);
+                        assert(len == _block_size);
+                }
+
+                struct snapshot_page *page = malloc(sizeof(*page));
+                assert(page != NULL);
+                int h = (offset / _block_size) % SNAPSHOT_HASH_SIZE;
+                page->offset = offset;
+                page->copy = copy;
+                page->next = snap->pages[h];
+                snap->pages[h] = page;
+                copy->refs++;
+        }
+        pthread_mutex_unlock(&tree->snap_lock);
+}
+
 /*
 B+树节点保存
 将其保存到index
@@ -236,197 +466,1366 @@ node指向的节点信息和其后面跟随的节点内容
 static inline void node_flush(struct bplus_tree *tree, struct bplus_node *node)
 {
         if (node != NULL) {
+                /*存在快照时先保存旧内容*/
+                if (tree->snap_buf != NULL) {
+                        snapshot_preserve(tree, node->self);
+                }
                 int len = pwrite(tree->fd, node, _block_size, node->self);
                 assert(len == _block_size);
+                tree->write_full++;
+                tree->write_bytes += _block_size;
                 cache_defer(tree, node);
         }
 }
 
 /*
-节点加入到树，为新节点分配新的偏移量，即文件大小
-判断链表是否为空，判断是否有空闲区块
+叶子节点只修改了from到to之前的数据时的保存，只写修改过的扇区
+修改过的部分是节点头、key数组和data数组中的各一段，分别按扇区对齐后写入，相邻或重叠的段合并为一次写
+末尾追加和原地更新只写两三个扇区，不写整个区块；三段合起来不比整个区块小时写整个区块
+from到to之后的旧数据不在children之内，不需要写
+*/
+static void leaf_flush_range(struct bplus_tree *tree, struct bplus_node *leaf, int from, int to)
+{
+        int sector = (tree->flags & BPLUS_TREE_DIRECT) ? DIRECT_IO_ALIGN : PARTIAL_WRITE_SECTOR;
+        int start[3], end[3], n = 0, i, total = 0;
+
+        if (_block_size <= 2 * sector) {
+                node_flush(tree, leaf);
+                return;
+        }
+
+        /*节点头，key和data中修改过的段，按在区块中的位置排列*/
+        start[0] = 0;
+        end[0] = sizeof(*leaf);
+        start[1] = (char *) &key(leaf)[from] - (char *) leaf;
+        end[1] = (char *) &key(leaf)[to] - (char *) leaf;
+        start[2] = (char *) &data(leaf)[from] - (char *) leaf;
+        end[2] = (char *) &data(leaf)[to] - (char *) leaf;
+
+        /*按扇区对齐并合并*/
+        for (i = 0; i < 3; i++) {
+                if (start[i] >= end[i]) {
+                        continue;
+                }
+                int s = start[i] / sector * sector;
+                int e = (end[i] + sector - 1) / sector * sector;
+                if (e > _block_size) {
+                        e = _block_size;
+                }
+                if (n > 0 && s <= end[n - 1]) {
+                        total += e - end[n - 1];
+                        end[n - 1] = e;
+                } else {
+                        start[n] = s;
+                        end[n] = e;
+                        total += e - s;
+                        n++;
+                }
+        }
+        if (total >= _block_size) {
+                node_flush(tree, leaf);
+                return;
+        }
+
+        /*存在快照时先保存旧内容*/
+        if (tree->snap_buf != NULL) {
+                snapshot_preserve(tree, leaf->self);
+        }
+        for (i = 0; i < n; i++) {
+                int len = pwrite(tree->fd, (char *) leaf + start[i], end[i] - start[i], leaf->self + start[i]);
+                assert(len == end[i] - start[i]);
+        }
+        tree->write_partial++;
+        tree->write_bytes += total;
+        cache_defer(tree, leaf);
+}
+
+/*
+将快照释放后不再被引用的副本区块移到空闲区块链表
+快照可能在其他线程释放，回收的区块先放在snap_reclaim，由写线程取走
+*/
+static void snapshot_reclaim(struct bplus_tree *tree)
+{
+        pthread_mutex_lock(&tree->snap_lock);
+        while (!list_empty(&tree->snap_reclaim)) {
+                struct list_head *pos = tree->snap_reclaim.next;
+                list_del(pos);
+                list_add_tail(pos, &tree->free_blocks);
+        }
+        pthread_mutex_unlock(&tree->snap_lock);
+}
+
+/*
+分配一个区块，判断链表是否为空，判断是否有空闲区块
+有空闲区块时重用，否则在.index末尾分配
 空闲区块首地址保存在.boot
 */
-static off_t new_node_append(struct bplus_tree *tree, struct bplus_node *node)
+static off_t block_new(struct bplus_tree *tree)
 {
+        off_t offset;
+
+        /*快照释放后回收的副本区块加入空闲区块链表*/
+        if (tree->snap_buf != NULL) {
+                snapshot_reclaim(tree);
+        }
+
         /*.index无空闲区块*/
         if (list_empty(&tree->free_blocks)) {
-                node->self = tree->file_size;
-                tree->file_size += _block_size;
+                offset = block_append(tree);
 		/*.inedx有空闲区块*/
         } else {
                 struct free_block *block;
                 block = list_first_entry(&tree->free_blocks, struct free_block, link);
                 list_del(&block->link);
-                node->self = block->offset;
+                offset = block->offset;
                 free(block);
         }
-        return node->self;
+        return offset;
 }
 
 /*
-从.index删除整个节点，多出一块空闲区块，添加到B+树信息结构体
-struct bplus_tree *tree-------------------B+树信息结构体
-struct bplus_node *node-------------------要被删除的节点
-struct bplus_node *left-------------------左孩子
-struct bplus_node *right------------------右孩子
+节点加入到树，为新节点分配新的偏移量
 */
-static void node_delete(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *right)
+static off_t new_node_append(struct bplus_tree *tree, struct bplus_node *node)
 {
-        if (left != NULL) {
-				/*左右孩子均存在*/
-                if (right != NULL) {
-                        left->next = right->self;
-                        right->prev = left->self;
-                        node_flush(tree, right);
-				/*左孩子存在，右孩子不存在*/
-                } else {
-                        left->next = INVALID_OFFSET;
-                }
-                node_flush(tree, left);
-        } else {
-				/*没有孩子节点*/
-                if (right != NULL) {
-                        right->prev = INVALID_OFFSET;
-                        node_flush(tree, right);
-                }
-        }
+        node->self = block_new(tree);
+        return node->self;
+}
 
-        assert(node->self != INVALID_OFFSET);
-        struct free_block *block = malloc(sizeof(*block));
-        assert(block != NULL);
-        /*空闲区块指向被删除节点在.index中的偏移量*/
-        block->offset = node->self;
-		/*添加空闲区块*/
-        list_add_tail(&block->link, &tree->free_blocks);
-        /*释放缓冲区*/
-        cache_defer(tree, node);
+/*
+键值的64位哈希
+*/
+static inline unsigned long key_hash(key_t key)
+{
+        unsigned long h = (unsigned int) key;
+        h += 0x9e3779b97f4a7c15UL;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9UL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebUL;
+        return h ^ (h >> 31);
 }
 
 /*
-更新非叶子节点的指向
-struct bplus_tree *tree----------------B+树信息结构体
-struct bplus_node *parent--------------父节点
-int index------------------------------插入位置
-struct bplus_node *sub_node------------要插入的分支
+自适应哈希索引中叶子节点的位置，按偏移量哈希
+返回--------------------------叶子节点记录的位置，不存在返回-1
 */
-static inline void sub_node_update(struct bplus_tree *tree, struct bplus_node *parent,
-                		   int index, struct bplus_node *sub_node)
+static int ahi_leaf_find(struct adaptive_hash *ahi, off_t offset)
 {
-        assert(sub_node->self != INVALID_OFFSET);
-        sub(parent)[index] = sub_node->self;
-        sub_node->parent = parent->self;
-        node_flush(tree, sub_node);
+        int i = ahi->leaf_buckets[(offset / _block_size) % ahi->leaf_capacity];
+        while (i >= 0 && ahi->leaves[i].offset != offset) {
+                i = ahi->leaves[i].next;
+        }
+        return i;
 }
 
 /*
-将分裂的非叶子节点的孩子重定向，并写入.index
-struct bplus_tree *tree----------------B+树信息结构体
-struct bplus_node *parent--------------分裂的新的非叶子节点
-off_t sub_offset-----------------------偏移量，即指向子节点的指针
+清空自适应哈希索引，键值或叶子节点记录用完时重新开始统计
 */
-static inline void sub_node_flush(struct bplus_tree *tree, struct bplus_node *parent, off_t sub_offset)
+static void ahi_reset(struct adaptive_hash *ahi)
 {
-        struct bplus_node *sub_node = node_fetch(tree, sub_offset);
-        assert(sub_node != NULL);
-        sub_node->parent = parent->self;
-        node_flush(tree, sub_node);
+        memset(ahi->buckets, -1, ahi->capacity * sizeof(int));
+        memset(ahi->leaf_buckets, -1, ahi->leaf_capacity * sizeof(int));
+        ahi->count = 0;
+        ahi->free = -1;
+        ahi->leaf_count = 0;
+        ahi->leaf_free = -1;
+        ahi->resets++;
 }
 
 /*
-B+树查找
+叶子节点的数据移到其他节点或者区块被释放，删除指向它的全部键值
 */
-static long bplus_tree_search(struct bplus_tree *tree, key_t key)
+static void ahi_leaf_drop(struct bplus_tree *tree, off_t offset)
 {
-        int ret = -1;
-		/*返回根节点的结构体*/
-        struct bplus_node *node = node_seek(tree, tree->root);
-        while (node != NULL) {
-                int i = key_binary_search(node, key);
-				/*到达叶子节点*/
-                if (is_leaf(node)) {
-                        ret = i >= 0 ? data(node)[i] : -1;
-                        break;
-				/*未到达叶子节点，循环递归*/
-                } else {
-                        if (i >= 0) {
-                                node = node_seek(tree, sub(node)[i + 1]);
-                        } else {
-                                i = -i - 1;
-                                node = node_seek(tree, sub(node)[i]);
-                        }
+        struct adaptive_hash *ahi = tree->ahi;
+        int l = ahi_leaf_find(ahi, offset);
+        if (l < 0) {
+                return;
+        }
+
+        /*从键值哈希链中摘下该叶子节点的键值，放入空闲链表*/
+        struct ahi_leaf *leaf = &ahi->leaves[l];
+        int i = leaf->keys;
+        while (i >= 0) {
+                struct ahi_entry *e = &ahi->entries[i];
+                int next = e->lnext;
+                int *p = &ahi->buckets[key_hash(e->key) % ahi->capacity];
+                while (*p != i) {
+                        p = &ahi->entries[*p].next;
                 }
+                *p = e->next;
+                e->lnext = ahi->free;
+                ahi->free = i;
+                i = next;
         }
 
-        return ret;
+        int *p = &ahi->leaf_buckets[(offset / _block_size) % ahi->leaf_capacity];
+        while (*p != l) {
+                p = &ahi->leaves[*p].next;
+        }
+        *p = leaf->next;
+        leaf->offset = INVALID_OFFSET;
+        leaf->next = ahi->leaf_free;
+        ahi->leaf_free = l;
+        ahi->drops++;
 }
 
 /*
-左节点添加
-设置左右兄弟叶子节点的指向，不存在就设置为非法
-struct bplus_tree *tree------------B+树信息结构体
-struct bplus_node *node------------B+树要分裂的节点
-struct bplus_node *left------------B+树左边的新节点
+叶子节点记录用完时，删除还没有加入索引的叶子节点的访问统计
 */
-static void left_node_add(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left)
+static void ahi_cold_purge(struct bplus_tree *tree)
 {
-        new_node_append(tree, left);
-
-        struct bplus_node *prev = node_fetch(tree, node->prev);
-        if (prev != NULL) {
-                prev->next = left->self;
-                left->prev = prev->self;
-                node_flush(tree, prev);
-        } else {
-                left->prev = INVALID_OFFSET;
+        struct adaptive_hash *ahi = tree->ahi;
+        int l;
+        for (l = 0; l < ahi->leaf_count; l++) {
+                if (ahi->leaves[l].offset != INVALID_OFFSET && ahi->leaves[l].hits < AHI_HOT_HITS) {
+                        ahi_leaf_drop(tree, ahi->leaves[l].offset);
+                }
         }
-        left->next = node->self;
-        node->prev = left->self;
 }
 
 /*
-右节点添加
-设置左右兄弟叶子节点的指向，不存在就设置为非法
-struct bplus_tree *tree------------B+树信息结构体
-struct bplus_node *node------------B+树要分裂的节点
-struct bplus_node *right-----------B+树右边的新节点
+在自适应哈希索引中查找键值所在的叶子节点
+返回--------------------------叶子节点的偏移量，不在索引中返回INVALID_OFFSET
 */
-static void right_node_add(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right)
+static off_t ahi_lookup(struct adaptive_hash *ahi, key_t key)
 {
-        new_node_append(tree, right);
-
-        struct bplus_node *next = node_fetch(tree, node->next);
-        if (next != NULL) {
-                next->prev = right->self;
-                right->next = next->self;
-                node_flush(tree, next);
-        } else {
-                right->next = INVALID_OFFSET;
+        int i = ahi->buckets[key_hash(key) % ahi->capacity];
+        while (i >= 0) {
+                if (ahi->entries[i].key == key) {
+                        return ahi->entries[i].leaf;
+                }
+                i = ahi->entries[i].next;
         }
-        right->prev = node->self;
-        node->next = right->self;
+        return INVALID_OFFSET;
 }
 
-/*非叶子节点插入，声明*/
-static key_t non_leaf_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key);
-
 /*
-下一层节点满后分裂，建立新的父节点，添加键值
-struct bplus_tree *tree-------------B+树信息结构体
-struct bplus_node *l_ch-------------B+树左孩子节点
-struct bplus_node *r_ch-------------B+树右孩子节点
-key_t key---------------------------后继节点的键值
+把键值加入自适应哈希索引，指向叶子节点记录l
+返回--------------------------成功返回0，键值记录用完时清空索引并返回-1
 */
-static int parent_node_build(struct bplus_tree *tree, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key)
+static int ahi_key_add(struct adaptive_hash *ahi, int l, key_t key)
 {
-		/*左右节点均没有父节点*/
-        if (l_ch->parent == INVALID_OFFSET && r_ch->parent == INVALID_OFFSET) {
-                /*左右节点均没有父节点，建立新的父节点*/
+        int i;
+        if (ahi->free >= 0) {
+                i = ahi->free;
+                ahi->free = ahi->entries[i].lnext;
+        } else if (ahi->count < ahi->capacity) {
+                i = ahi->count++;
+        } else {
+                ahi_reset(ahi);
+                return -1;
+        }
+
+        struct ahi_entry *e = &ahi->entries[i];
+        int b = key_hash(key) % ahi->capacity;
+        e->key = key;
+        e->leaf = ahi->leaves[l].offset;
+        e->next = ahi->buckets[b];
+        ahi->buckets[b] = i;
+        e->lnext = ahi->leaves[l].keys;
+        ahi->leaves[l].keys = i;
+        return 0;
+}
+
+/*
+查找经过根节点到达叶子节点后记录访问次数
+叶子节点访问AHI_HOT_HITS次后把它的全部键值加入索引，已在索引中的叶子节点只补充新插入的键值
+*/
+static void ahi_leaf_visit(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, int found)
+{
+        struct adaptive_hash *ahi = tree->ahi;
+        int l = ahi_leaf_find(ahi, leaf->self);
+
+        if (l < 0) {
+                if (ahi->leaf_free >= 0) {
+                        l = ahi->leaf_free;
+                        ahi->leaf_free = ahi->leaves[l].next;
+                } else if (ahi->leaf_count < ahi->leaf_capacity) {
+                        l = ahi->leaf_count++;
+                } else {
+                        ahi_cold_purge(tree);
+                        if (ahi->leaf_free < 0) {
+                                ahi_reset(ahi);
+                        }
+                        return;
+                }
+                int b = (leaf->self / _block_size) % ahi->leaf_capacity;
+                ahi->leaves[l].offset = leaf->self;
+                ahi->leaves[l].hits = 0;
+                ahi->leaves[l].keys = -1;
+                ahi->leaves[l].next = ahi->leaf_buckets[b];
+                ahi->leaf_buckets[b] = l;
+        }
+
+        struct ahi_leaf *rec = &ahi->leaves[l];
+        if (rec->hits < AHI_HOT_HITS) {
+                if (++rec->hits == AHI_HOT_HITS) {
+                        int i;
+                        for (i = 0; i < leaf->children; i++) {
+                                if (ahi_key_add(ahi, l, key(leaf)[i]) < 0) {
+                                        return;
+                                }
+                        }
+                }
+        } else if (found) {
+                ahi_key_add(ahi, l, key);
+        }
+}
+
+/*
+拟合分段线性模型：叶子节点的第一个键值 -> 叶子节点在数组中的位置
+收缩锥贪心算法，每一段内预测位置和实际位置相差不超过eps
+第一个键值不是严格递增时模型失效，需要从叶子节点链表重建
+*/
+static void learned_fit(struct learned_index *li)
+{
+        long i, x0 = 0;
+        double lo = 0, hi = DBL_MAX;
+
+        li->nsegs = 0;
+        li->drift = 0;
+        li->refits++;
+        if (li->n == 0) {
+                return;
+        }
+        li->segs = realloc(li->segs, li->n * sizeof(struct learned_segment));
+        assert(li->segs != NULL);
+
+        for (i = 1; i <= li->n; i++) {
+                if (i < li->n) {
+                        if (li->keys[i] <= li->keys[i - 1]) {
+                                li->stale = 1;
+                                return;
+                        }
+                        double dx = (double) li->keys[i] - li->keys[x0];
+                        double l = (i - x0 - li->eps) / dx, h = (i - x0 + li->eps) / dx;
+                        if ((l > lo ? l : lo) <= (h < hi ? h : hi)) {
+                                lo = l > lo ? l : lo;
+                                hi = h < hi ? h : hi;
+                                continue;
+                        }
+                }
+                /*当前点放不进这一段，结束这一段*/
+                struct learned_segment *seg = &li->segs[li->nsegs++];
+                seg->key = li->keys[x0];
+                seg->start = x0;
+                seg->slope = hi == DBL_MAX ? 0 : (lo + hi) / 2;
+                x0 = i;
+                lo = 0;
+                hi = DBL_MAX;
+        }
+}
+
+/*
+模型预测键值所在叶子节点在数组中的位置
+*/
+static long learned_predict(struct learned_index *li, key_t key)
+{
+        long lo = 0, hi = li->nsegs - 1;
+
+        /*最后一个第一个键值不大于key的段*/
+        while (lo < hi) {
+                long mid = (lo + hi + 1) / 2;
+                if (li->segs[mid].key <= key) {
+                        lo = mid;
+                } else {
+                        hi = mid - 1;
+                }
+        }
+        struct learned_segment *seg = &li->segs[lo];
+        long end = lo + 1 < li->nsegs ? li->segs[lo + 1].start - 1 : li->n - 1;
+        double delta = (double) key - seg->key;
+        long pos = seg->start + (long) (seg->slope * (delta > 0 ? delta : 0));
+        return pos < end ? pos : end;
+}
+
+/*
+在学习索引中查找键值所在的叶子节点
+在预测位置前后eps+drift的窗口内二分查找，窗口没有覆盖到时返回非法偏移量
+*/
+static off_t learned_lookup(struct learned_index *li, key_t key)
+{
+        if (li->n == 0 || li->stale) {
+                return INVALID_OFFSET;
+        }
+        if (key < li->keys[0]) {
+                return li->leaves[0];
+        }
+
+        long pos = learned_predict(li, key);
+        long w = li->eps + li->drift + 1;
+        long lo = pos - w > 0 ? pos - w : 0;
+        long hi = pos + w < li->n - 1 ? pos + w : li->n - 1;
+        if (li->keys[lo] > key || (hi < li->n - 1 && li->keys[hi + 1] <= key)) {
+                return INVALID_OFFSET;
+        }
+
+        /*最后一个第一个键值不大于key的叶子节点*/
+        while (lo < hi) {
+                long mid = (lo + hi + 1) / 2;
+                if (li->keys[mid] <= key) {
+                        lo = mid;
+                } else {
+                        hi = mid - 1;
+                }
+        }
+        return li->leaves[lo];
+}
+
+/*
+叶子节点在数组中的位置，先在预测位置附近查找，找不到时顺序查找
+返回--------------------------位置，不在数组中返回-1
+*/
+static long learned_position(struct learned_index *li, off_t offset, key_t hint)
+{
+        long i;
+        if (li->nsegs > 0) {
+                long pos = learned_predict(li, hint);
+                long w = li->eps + li->drift + 2;
+                for (i = pos - w > 0 ? pos - w : 0; i < li->n && i <= pos + w; i++) {
+                        if (li->leaves[i] == offset) {
+                                return i;
+                        }
+                }
+        }
+        for (i = 0; i < li->n; i++) {
+                if (li->leaves[i] == offset) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/*
+数组中插入或删除叶子节点后，预测位置的偏差增加，偏差超过eps时重新拟合，不需要读取叶子节点
+*/
+static void learned_drift(struct learned_index *li)
+{
+        if (++li->drift > li->eps) {
+                learned_fit(li);
+        }
+}
+
+/*
+叶子节点分裂后把新的叶子节点加入数组
+struct bplus_node *leaf-------原叶子节点
+struct bplus_node *sibling----分裂出的叶子节点
+int left----------------------分裂出的叶子节点在左边为1
+*/
+static void learned_leaf_split(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *sibling, int left)
+{
+        struct learned_index *li = tree->learned;
+        if (li->stale) {
+                return;
+        }
+
+        struct bplus_node *l = left ? sibling : leaf, *r = left ? leaf : sibling;
+        long j = learned_position(li, leaf->self, key(l)[0]);
+        if (j < 0) {
+                li->stale = 1;
+                return;
+        }
+        if (li->n == li->cap) {
+                li->cap = li->cap * 2 + 16;
+                li->keys = realloc(li->keys, li->cap * sizeof(key_t));
+                li->leaves = realloc(li->leaves, li->cap * sizeof(off_t));
+                assert(li->keys != NULL && li->leaves != NULL);
+        }
+        memmove(&li->keys[j + 1], &li->keys[j], (li->n - j) * sizeof(key_t));
+        memmove(&li->leaves[j + 1], &li->leaves[j], (li->n - j) * sizeof(off_t));
+        li->n++;
+
+        li->keys[j] = key(l)[0];
+        li->leaves[j] = l->self;
+        li->keys[j + 1] = key(r)[0];
+        li->leaves[j + 1] = r->self;
+
+        /*前后的第一个键值可能已经过时，顺序不对时重建*/
+        if ((j > 0 && li->keys[j - 1] >= li->keys[j]) || (j + 2 < li->n && li->keys[j + 1] >= li->keys[j + 2])) {
+                li->stale = 1;
+                return;
+        }
+        learned_drift(li);
+}
+
+/*
+区块释放时从数组中删除叶子节点
+*/
+static void learned_leaf_remove(struct bplus_tree *tree, off_t offset)
+{
+        struct learned_index *li = tree->learned;
+        long j;
+        if (li->stale) {
+                return;
+        }
+        for (j = 0; j < li->n && li->leaves[j] != offset; j++) {
+                continue;
+        }
+        if (j < li->n) {
+                memmove(&li->keys[j], &li->keys[j + 1], (li->n - j - 1) * sizeof(key_t));
+                memmove(&li->leaves[j], &li->leaves[j + 1], (li->n - j - 1) * sizeof(off_t));
+                li->n--;
+                learned_drift(li);
+        }
+}
+
+/*
+模型没有找到叶子节点时，用从根节点查找到的叶子节点修正过时的第一个键值
+*/
+static void learned_leaf_fix(struct bplus_tree *tree, struct bplus_node *leaf)
+{
+        struct learned_index *li = tree->learned;
+        if (li->stale || leaf->children == 0) {
+                return;
+        }
+        long j = learned_position(li, leaf->self, key(leaf)[0]);
+        if (j < 0) {
+                li->stale = 1;
+        } else if ((j == 0 || li->keys[j - 1] < key(leaf)[0]) && (j + 1 == li->n || key(leaf)[0] < li->keys[j + 1])) {
+                li->keys[j] = key(leaf)[0];
+        }
+}
+
+/*
+将节点从待整理的欠满叶子节点队列中移除
+节点被删除后偏移量会被重用，队列中不能留下已删除的节点
+*/
+static void lazy_leaf_purge(struct bplus_tree *tree, off_t offset)
+{
+        struct list_head *pos, *n;
+        list_for_each_safe(pos, n, &tree->lazy_leaves) {
+                struct lazy_leaf *lazy = list_entry(pos, struct lazy_leaf, link);
+                if (lazy->offset == offset) {
+                        list_del(pos);
+                        free(lazy);
+                }
+        }
+}
+
+/*
+释放.index中的一个区块，添加到空闲区块链表，以备重用
+*/
+static void block_free(struct bplus_tree *tree, off_t offset)
+{
+        assert(offset != INVALID_OFFSET);
+        /*最右叶子节点被释放，需要重新查找*/
+        if (offset == tree->tail) {
+                tree->tail = INVALID_OFFSET;
+        }
+        /*合并和删除节点都经过这里，释放的区块不能再从自适应哈希索引跳转*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, offset);
+        }
+        if (tree->learned != NULL) {
+                learned_leaf_remove(tree, offset);
+        }
+        lazy_leaf_purge(tree, offset);
+        struct free_block *block = malloc(sizeof(*block));
+        assert(block != NULL);
+        /*空闲区块指向被删除节点在.index中的偏移量*/
+        block->offset = offset;
+		/*添加空闲区块*/
+        list_add_tail(&block->link, &tree->free_blocks);
+}
+
+/*
+从.index删除整个节点，多出一块空闲区块，添加到B+树信息结构体
+struct bplus_tree *tree-------------------B+树信息结构体
+struct bplus_node *node-------------------要被删除的节点
+struct bplus_node *left-------------------左孩子
+struct bplus_node *right------------------右孩子
+*/
+static void node_delete(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *right)
+{
+        if (left != NULL) {
+				/*左右孩子均存在*/
+                if (right != NULL) {
+                        left->next = right->self;
+                        right->prev = left->self;
+                        node_flush(tree, right);
+				/*左孩子存在，右孩子不存在*/
+                } else {
+                        left->next = INVALID_OFFSET;
+                }
+                node_flush(tree, left);
+        } else {
+				/*没有孩子节点*/
+                if (right != NULL) {
+                        right->prev = INVALID_OFFSET;
+                        node_flush(tree, right);
+                }
+        }
+
+        /*删除的是最右叶子节点，左兄弟成为新的最右叶子节点*/
+        if (node->self == tree->tail && left != NULL) {
+                tree->tail = left->self;
+        }
+        block_free(tree, node->self);
+        /*释放缓冲区*/
+        cache_defer(tree, node);
+}
+
+/*
+多值模式下叶子节点中数据的编码
+大于等于0：只有一个值，直接保存在叶子节点
+小于-1：值的有序列表保存在溢出页，posting_decode得到第一个溢出页的偏移量
+-1留给不存在的键值
+*/
+#define is_posting(data) ((data) < -1)
+#define posting_encode(offset) (-2 - (long) (offset))
+#define posting_decode(data) ((off_t) (-2 - (data)))
+
+/*溢出页中差值编码的起始位置和可用空间*/
+#define posting_bytes(page) ((unsigned char *) (page) + sizeof(struct posting_page))
+#define POSTING_SPACE (_block_size - (int) sizeof(struct posting_page))
+
+/*
+变长编码一个差值，每个字节保存7位，最高位表示后面还有字节
+返回--------------------------编码占用的字节数
+*/
+static inline int varint_put(unsigned char *p, unsigned long v)
+{
+        int n = 0;
+        while (v >= 0x80) {
+                p[n++] = (v & 0x7f) | 0x80;
+                v >>= 7;
+        }
+        p[n++] = v;
+        return n;
+}
+
+/*
+解码一个差值
+返回--------------------------编码占用的字节数
+*/
+static inline int varint_get(unsigned char *p, unsigned long *v)
+{
+        int n = 0, shift = 0;
+        *v = 0;
+        do {
+                *v |= (unsigned long) (p[n] & 0x7f) << shift;
+                shift += 7;
+        } while (p[n++] & 0x80);
+        return n;
+}
+
+/*
+差值编码后的字节数
+*/
+static inline int varint_len(unsigned long v)
+{
+        int n = 1;
+        while (v >= 0x80) {
+                v >>= 7;
+                n++;
+        }
+        return n;
+}
+
+/*
+读取溢出页
+*/
+static inline void posting_read(struct bplus_tree *tree, off_t offset, struct posting_page *page)
+{
+        int len = pread(tree->fd, page, _block_size, offset);
+        assert(len == _block_size);
+}
+
+/*
+写入溢出页，存在快照时和节点一样先保存旧内容
+*/
+static inline void posting_write(struct bplus_tree *tree, struct posting_page *page, off_t offset)
+{
+        if (tree->snap_buf != NULL) {
+                snapshot_preserve(tree, offset);
+        }
+        int len = pwrite(tree->fd, page, _block_size, offset);
+        assert(len == _block_size);
+}
+
+/*
+读取整个值列表
+long **values-----------------返回的值，由调用者释放
+off_t **pages-----------------返回各溢出页的偏移量，由调用者释放，可以为NULL
+int *npages-------------------返回溢出页个数
+返回--------------------------值的个数
+*/
+static long posting_load(struct bplus_tree *tree, off_t head, long **values, off_t **pages, int *npages)
+{
+        struct posting_page *page = (struct posting_page *) tree->post_buf;
+        off_t offset = head;
+        long n = 0;
+        int m = 0;
+
+        posting_read(tree, head, page);
+        *values = malloc(page->total * sizeof(long));
+        assert(*values != NULL);
+        if (pages != NULL) {
+                *pages = NULL;
+        }
+
+        while (offset != INVALID_OFFSET) {
+                if (offset != head) {
+                        posting_read(tree, offset, page);
+                }
+                if (pages != NULL) {
+                        *pages = realloc(*pages, (m + 1) * sizeof(off_t));
+                        assert(*pages != NULL);
+                        (*pages)[m] = offset;
+                }
+                m++;
+
+                /*第一个值完整保存，之后是和前一个值的差*/
+                unsigned char *p = posting_bytes(page);
+                long v = page->first;
+                int i;
+                (*values)[n++] = v;
+                for (i = 1; i < page->count; i++) {
+                        unsigned long delta;
+                        p += varint_get(p, &delta);
+                        v += delta;
+                        (*values)[n++] = v;
+                }
+                offset = page->next;
+        }
+        if (npages != NULL) {
+                *npages = m;
+        }
+        return n;
+}
+
+/*
+把有序的值列表重新写入溢出页，第一个溢出页的偏移量不变，叶子节点中的数据不需要修改
+依次重用原来的溢出页，不够时分配新的区块，多余的释放
+off_t head--------------------第一个溢出页，非法偏移量表示新建列表
+long n------------------------值的个数，不少于2
+返回--------------------------第一个溢出页的偏移量
+*/
+static off_t posting_store(struct bplus_tree *tree, off_t head, long *values, long n, off_t *pages, int npages)
+{
+        struct posting_page *head_page = (struct posting_page *) (tree->post_buf + _block_size);
+        struct posting_page *page = (struct posting_page *) tree->post_buf;
+        off_t offset, tail = INVALID_OFFSET;
+        long i = 0;
+        int j = 0;
+
+        if (head == INVALID_OFFSET) {
+                head = block_new(tree);
+        }
+        offset = head;
+
+        while (i < n) {
+                /*第一页最后写入，写入前设置列表的总数和最后一页*/
+                struct posting_page *p = j == 0 ? head_page : page;
+                memset(p, 0, _block_size);
+                p->first = p->last = values[i++];
+                p->count = 1;
+                while (i < n) {
+                        unsigned long delta = values[i] - p->last;
+                        if (p->bytes + varint_len(delta) > POSTING_SPACE) {
+                                break;
+                        }
+                        p->bytes += varint_put(posting_bytes(p) + p->bytes, delta);
+                        p->last = values[i++];
+                        p->count++;
+                }
+
+                p->tail = INVALID_OFFSET;
+                p->next = INVALID_OFFSET;
+                if (i < n) {
+                        p->next = ++j < npages ? pages[j] : block_new(tree);
+                }
+                tail = offset;
+                if (p != head_page) {
+                        posting_write(tree, p, offset);
+                }
+                offset = p->next;
+        }
+
+        /*释放多余的溢出页*/
+        for (j++; j < npages; j++) {
+                block_free(tree, pages[j]);
+        }
+
+        head_page->total = n;
+        head_page->tail = tail;
+        posting_write(tree, head_page, head);
+        return head;
+}
+
+/*
+向值列表追加值
+值大于最后一个值时只修改最后一页和第一页，最后一页放不下就链接一个新的溢出页
+否则读出整个列表，插入后重新写入
+返回--------------------------成功返回0，值已存在返回-1
+*/
+static int posting_add(struct bplus_tree *tree, off_t head, long value)
+{
+        struct posting_page *head_page = (struct posting_page *) (tree->post_buf + _block_size);
+        struct posting_page *page = (struct posting_page *) tree->post_buf;
+        struct posting_page *last = head_page;
+
+        posting_read(tree, head, head_page);
+        if (head_page->tail != head) {
+                posting_read(tree, head_page->tail, page);
+                last = page;
+        }
+
+        /*追加到末尾*/
+        if (value > last->last) {
+                unsigned long delta = value - last->last;
+                int len = varint_len(delta);
+                if (last->bytes + len <= POSTING_SPACE) {
+                        varint_put(posting_bytes(last) + last->bytes, delta);
+                        last->bytes += len;
+                        last->last = value;
+                        last->count++;
+                        if (last != head_page) {
+                                posting_write(tree, last, head_page->tail);
+                        }
+                } else {
+                        off_t offset = block_new(tree);
+                        last->next = offset;
+                        if (last != head_page) {
+                                posting_write(tree, last, head_page->tail);
+                        }
+                        memset(page, 0, _block_size);
+                        page->next = INVALID_OFFSET;
+                        page->tail = INVALID_OFFSET;
+                        page->first = page->last = value;
+                        page->count = 1;
+                        posting_write(tree, page, offset);
+                        head_page->tail = offset;
+                }
+                head_page->total++;
+                posting_write(tree, head_page, head);
+                return 0;
+        }
+
+        /*插入到中间*/
+        long *values;
+        off_t *pages;
+        int npages;
+        long n = posting_load(tree, head, &values, &pages, &npages);
+        long lo = 0, hi = n;
+        while (lo < hi) {
+                long mid = (lo + hi) / 2;
+                if (values[mid] < value) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        if (lo < n && values[lo] == value) {
+                free(values);
+                free(pages);
+                return -1;
+        }
+        values = realloc(values, (n + 1) * sizeof(long));
+        assert(values != NULL);
+        memmove(&values[lo + 1], &values[lo], (n - lo) * sizeof(long));
+        values[lo] = value;
+        posting_store(tree, head, values, n + 1, pages, npages);
+        free(values);
+        free(pages);
+        return 0;
+}
+
+/*
+释放叶子节点数据对应的溢出页，数据不是值列表时什么也不做
+*/
+static void posting_drop(struct bplus_tree *tree, long data)
+{
+        struct posting_page *page = (struct posting_page *) tree->post_buf;
+
+        if (!is_posting(data)) {
+                return;
+        }
+        off_t offset = posting_decode(data);
+        while (offset != INVALID_OFFSET) {
+                posting_read(tree, offset, page);
+                block_free(tree, offset);
+                offset = page->next;
+        }
+}
+
+/*
+节点为根的子树内的键值个数
+叶子节点为数据个数，非叶子节点为各分支计数之和
+*/
+static long node_total(struct bplus_node *node)
+{
+        if (is_leaf(node)) {
+                return node->children;
+        }
+
+        int i;
+        long total = 0;
+        for (i = 0; i < node->children; i++) {
+                total += count(node)[i];
+        }
+        return total;
+}
+
+/*
+分支计数随分支指针一起移动，与移动sub的memmove对应
+*/
+static inline void count_move(struct bplus_tree *tree, struct bplus_node *dst, int d, struct bplus_node *src, int s, int n)
+{
+        if (tree->flags & BPLUS_TREE_COUNTS) {
+                memmove(&count(dst)[d], &count(src)[s], n * sizeof(long));
+        }
+}
+
+/*
+兄弟节点之间移动数据或合并后，重新设置节点在父节点中的分支计数
+父节点和节点都在缓存中，不需要额外读取
+*/
+static inline void count_sync(struct bplus_tree *tree, struct bplus_node *parent, struct bplus_node *node)
+{
+        if (tree->flags & BPLUS_TREE_COUNTS) {
+                count(parent)[parent_sub_index(parent, node->self)] = node_total(node);
+        }
+}
+
+/*
+更新非叶子节点的指向
+struct bplus_tree *tree----------------B+树信息结构体
+struct bplus_node *parent--------------父节点
+int index------------------------------插入位置
+struct bplus_node *sub_node------------要插入的分支
+*/
+static inline void sub_node_update(struct bplus_tree *tree, struct bplus_node *parent,
+                		   int index, struct bplus_node *sub_node)
+{
+        assert(sub_node->self != INVALID_OFFSET);
+        sub(parent)[index] = sub_node->self;
+        if (tree->flags & BPLUS_TREE_COUNTS) {
+                count(parent)[index] = node_total(sub_node);
+        }
+        sub_node->parent = parent->self;
+        node_flush(tree, sub_node);
+}
+
+/*
+将分裂的非叶子节点的孩子重定向，并写入.index
+struct bplus_tree *tree----------------B+树信息结构体
+struct bplus_node *parent--------------分裂的新的非叶子节点
+off_t sub_offset-----------------------偏移量，即指向子节点的指针
+*/
+static inline void sub_node_flush(struct bplus_tree *tree, struct bplus_node *parent, off_t sub_offset)
+{
+        struct bplus_node *sub_node = node_fetch(tree, sub_offset);
+        assert(sub_node != NULL);
+        sub_node->parent = parent->self;
+        node_flush(tree, sub_node);
+}
+
+/*
+B+树查找
+*/
+/*
+把键值加入布隆过滤器
+由一个64位哈希得到两个哈希值，第i个位置为h1+i*h2
+*/
+static void bloom_add(struct bplus_tree *tree, key_t key)
+{
+        unsigned long h = key_hash(key);
+        unsigned long h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+        int i;
+        for (i = 0; i < tree->bloom_hashes; i++) {
+                unsigned long bit = (h1 + i * h2) % tree->bloom_bits;
+                tree->bloom[bit >> 3] |= 1 << (bit & 7);
+        }
+        tree->bloom_keys++;
+}
+
+/*
+查询布隆过滤器
+返回--------------------------键值可能存在返回1，一定不存在返回0
+*/
+static int bloom_test(struct bplus_tree *tree, key_t key)
+{
+        unsigned long h = key_hash(key);
+        unsigned long h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+        int i;
+        for (i = 0; i < tree->bloom_hashes; i++) {
+                unsigned long bit = (h1 + i * h2) % tree->bloom_bits;
+                if (!(tree->bloom[bit >> 3] & (1 << (bit & 7)))) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/*
+键值所在的热点缓存分片
+*/
+static inline struct hot_shard *hot_shard_of(struct bplus_tree *tree, unsigned long h)
+{
+        return &tree->hot[h & (tree->hot_shards - 1)];
+}
+
+/*
+在热点缓存中查找键值
+返回--------------------------缓存项的位置，不在缓存中返回-1
+*/
+static int hot_find(struct hot_shard *shard, key_t key, unsigned long h)
+{
+        int i = shard->buckets[(h >> 16) % shard->nbuckets];
+        while (i >= 0 && shard->entries[i].key != key) {
+                i = shard->entries[i].next;
+        }
+        return i;
+}
+
+/*
+把缓存项从哈希链中摘下
+*/
+static void hot_unlink(struct hot_shard *shard, int i, unsigned long h)
+{
+        int *p = &shard->buckets[(h >> 16) % shard->nbuckets];
+        while (*p != i) {
+                p = &shard->entries[*p].next;
+        }
+        *p = shard->entries[i].next;
+        shard->entries[i].used = 0;
+}
+
+/*
+查找成功后把键值和数据放入热点缓存
+有空闲的缓存项直接使用，否则CLOCK淘汰：指针扫过的缓存项访问位为1时清0，遇到访问位为0的缓存项淘汰
+*/
+static void hot_insert(struct bplus_tree *tree, key_t key, long data)
+{
+        unsigned long h = key_hash(key);
+        struct hot_shard *shard = hot_shard_of(tree, h);
+        int i;
+
+        if (shard->free >= 0) {
+                i = shard->free;
+                shard->free = shard->entries[i].next;
+        } else if (shard->count < shard->capacity) {
+                i = shard->count++;
+        } else {
+                while (shard->entries[shard->hand].ref) {
+                        shard->entries[shard->hand].ref = 0;
+                        shard->hand = (shard->hand + 1) % shard->capacity;
+                }
+                i = shard->hand;
+                shard->hand = (shard->hand + 1) % shard->capacity;
+                hot_unlink(shard, i, key_hash(shard->entries[i].key));
+                shard->evictions++;
+        }
+
+        struct hot_entry *e = &shard->entries[i];
+        int b = (h >> 16) % shard->nbuckets;
+        e->key = key;
+        e->data = data;
+        e->ref = 0;
+        e->used = 1;
+        e->next = shard->buckets[b];
+        shard->buckets[b] = i;
+}
+
+/*
+键值的数据改变或者键值被删除，从热点缓存中删除
+*/
+static void hot_invalidate(struct bplus_tree *tree, key_t key)
+{
+        unsigned long h = key_hash(key);
+        struct hot_shard *shard = hot_shard_of(tree, h);
+        int i = hot_find(shard, key, h);
+        if (i >= 0) {
+                hot_unlink(shard, i, h);
+                /*空闲的缓存项不参与CLOCK淘汰，放入空闲链表*/
+                shard->entries[i].next = shard->free;
+                shard->free = i;
+        }
+}
+
+/*
+范围删除后从热点缓存中删除lo到hi之间(包含两端)的键值
+*/
+static void hot_invalidate_range(struct bplus_tree *tree, key_t lo, key_t hi)
+{
+        int s, i;
+        for (s = 0; s < tree->hot_shards; s++) {
+                struct hot_shard *shard = &tree->hot[s];
+                for (i = 0; i < shard->count; i++) {
+                        struct hot_entry *e = &shard->entries[i];
+                        if (e->used && e->key >= lo && e->key <= hi) {
+                                hot_invalidate(tree, e->key);
+                        }
+                }
+        }
+}
+
+/*
+沿叶子节点链表重建学习索引，跳过空的叶子节点
+*/
+static void learned_rebuild(struct bplus_tree *tree)
+{
+        struct learned_index *li = tree->learned;
+        struct bplus_node *node;
+
+        li->n = 0;
+        for (node = leaf_first(tree); node != NULL; node = node_seek(tree, node->next)) {
+                if (node->children == 0) {
+                        continue;
+                }
+                if (li->n == li->cap) {
+                        li->cap = li->cap * 2 + 16;
+                        li->keys = realloc(li->keys, li->cap * sizeof(key_t));
+                        li->leaves = realloc(li->leaves, li->cap * sizeof(off_t));
+                        assert(li->keys != NULL && li->leaves != NULL);
+                }
+                li->keys[li->n] = key(node)[0];
+                li->leaves[li->n] = node->self;
+                li->n++;
+        }
+        li->stale = 0;
+        li->rebuilds++;
+        learned_fit(li);
+}
+
+static long bplus_tree_search(struct bplus_tree *tree, key_t key)
+{
+        long ret = -1;
+
+        /*热点缓存命中，不需要查找*/
+        if (tree->hot != NULL) {
+                unsigned long h = key_hash(key);
+                struct hot_shard *shard = hot_shard_of(tree, h);
+                int i = hot_find(shard, key, h);
+                if (i >= 0) {
+                        shard->entries[i].ref = 1;
+                        shard->hits++;
+                        return shard->entries[i].data;
+                }
+                shard->misses++;
+        }
+
+        /*过滤器判断键值一定不存在，不需要读取节点*/
+        if (tree->bloom != NULL) {
+                tree->bloom_lookups++;
+                if (!bloom_test(tree, key)) {
+                        tree->bloom_negatives++;
+                        return -1;
+                }
+        }
+
+        /*自适应哈希索引直接跳到叶子节点，叶子节点中找不到键值时从根节点查找*/
+        if (tree->ahi != NULL) {
+                off_t offset = ahi_lookup(tree->ahi, key);
+                if (offset != INVALID_OFFSET) {
+                        struct bplus_node *leaf = node_seek(tree, offset);
+                        int i = is_leaf(leaf) ? key_binary_search(tree, leaf, key) : -1;
+                        if (i >= 0) {
+                                tree->ahi->hits++;
+                                ret = data(leaf)[i];
+                                if (tree->hot != NULL) {
+                                        hot_insert(tree, key, ret);
+                                }
+                                return ret;
+                        }
+                        ahi_leaf_drop(tree, offset);
+                }
+                tree->ahi->misses++;
+        }
+
+        /*
+        学习索引预测叶子节点，只读取一个叶子节点
+        叶子节点的键值范围包含key时结果确定，否则从根节点查找
+        */
+        int learned_miss = 0;
+        if (tree->learned != NULL) {
+                if (tree->learned->stale) {
+                        learned_rebuild(tree);
+                }
+                off_t offset = learned_lookup(tree->learned, key);
+                if (offset != INVALID_OFFSET) {
+                        struct bplus_node *leaf = node_seek(tree, offset);
+                        if (is_leaf(leaf) && leaf->children > 0 &&
+                            key(leaf)[0] <= key && key <= key(leaf)[leaf->children - 1]) {
+                                int i = key_binary_search(tree, leaf, key);
+                                tree->learned->hits++;
+                                if (i >= 0) {
+                                        ret = data(leaf)[i];
+                                        if (tree->hot != NULL) {
+                                                hot_insert(tree, key, ret);
+                                        }
+                                } else if (tree->bloom != NULL) {
+                                        tree->bloom_false++;
+                                }
+                                return ret;
+                        }
+                }
+                tree->learned->misses++;
+                learned_miss = 1;
+        }
+
+		/*返回根节点的结构体*/
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+                int i = key_binary_search(tree, node, key);
+				/*到达叶子节点*/
+                if (is_leaf(node)) {
+                        if (i >= 0) {
+                                ret = data(node)[i];
+                                if (tree->hot != NULL) {
+                                        hot_insert(tree, key, ret);
+                                }
+                        } else if (tree->bloom != NULL) {
+                                /*过滤器误判*/
+                                tree->bloom_false++;
+                        }
+                        if (tree->ahi != NULL) {
+                                ahi_leaf_visit(tree, node, key, i >= 0);
+                        }
+                        if (learned_miss) {
+                                learned_leaf_fix(tree, node);
+                        }
+                        break;
+				/*未到达叶子节点，循环递归*/
+                } else {
+                        if (i >= 0) {
+                                node = node_seek(tree, sub(node)[i + 1]);
+                        } else {
+                                i = -i - 1;
+                                node = node_seek(tree, sub(node)[i]);
+                        }
+                }
+        }
+
+        return ret;
+}
+
+/*
+记录从根节点到键值所在叶子节点的路径
+off_t *path---------------------------路径上每一层节点的偏移量，path[0]为根节点
+返回----------------------------------路径长度，即B+树的层数，空树返回0
+*/
+static int path_search(struct bplus_tree *tree, key_t key, off_t *path)
+{
+        int depth = 0;
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+                assert(depth < MAX_DEPTH);
+                path[depth++] = node->self;
+                if (is_leaf(node)) {
+                        break;
+                }
+                int i = key_binary_search(tree, node, key);
+                if (i >= 0) {
+                        node = node_seek(tree, sub(node)[i + 1]);
+                } else {
+                        i = -i - 1;
+                        node = node_seek(tree, sub(node)[i]);
+                }
+        }
+        return depth;
+}
+
+/*
+插入或删除键值后，自底向上重新计算路径上的分支计数
+路径以外的节点在分裂、合并、移动数据时已经设置好计数，只有路径上的祖先节点的计数变化
+*/
+static void count_path_fix(struct bplus_tree *tree, key_t key)
+{
+        off_t path[MAX_DEPTH];
+
+        if (!(tree->flags & BPLUS_TREE_COUNTS) || tree->root == INVALID_OFFSET) {
+                return;
+        }
+
+        int d = path_search(tree, key, path) - 1;
+        struct bplus_node *node = node_fetch(tree, path[d]);
+        long total = node_total(node);
+        cache_defer(tree, node);
+        while (d > 0) {
+                struct bplus_node *parent = node_fetch(tree, path[--d]);
+                count(parent)[parent_sub_index(parent, path[d + 1])] = total;
+                total = node_total(parent);
+                node_flush(tree, parent);
+        }
+}
+
+/*
+左节点添加
+设置左右兄弟叶子节点的指向，不存在就设置为非法
+struct bplus_tree *tree------------B+树信息结构体
+struct bplus_node *node------------B+树要分裂的节点
+struct bplus_node *left------------B+树左边的新节点
+*/
+static void left_node_add(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left)
+{
+        new_node_append(tree, left);
+
+        struct bplus_node *prev = node_fetch(tree, node->prev);
+        if (prev != NULL) {
+                prev->next = left->self;
+                left->prev = prev->self;
+                node_flush(tree, prev);
+        } else {
+                left->prev = INVALID_OFFSET;
+        }
+        left->next = node->self;
+        node->prev = left->self;
+}
+
+/*
+右节点添加
+设置左右兄弟叶子节点的指向，不存在就设置为非法
+struct bplus_tree *tree------------B+树信息结构体
+struct bplus_node *node------------B+树要分裂的节点
+struct bplus_node *right-----------B+树右边的新节点
+*/
+static void right_node_add(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right)
+{
+        new_node_append(tree, right);
+
+        struct bplus_node *next = node_fetch(tree, node->next);
+        if (next != NULL) {
+                next->prev = right->self;
+                right->next = next->self;
+                node_flush(tree, next);
+        } else {
+                right->next = INVALID_OFFSET;
+        }
+        right->prev = node->self;
+        node->next = right->self;
+
+        /*最右叶子节点向右分裂，新节点成为最右叶子节点*/
+        if (node->self == tree->tail) {
+                tree->tail = right->self;
+        }
+}
+
+/*非叶子节点插入，声明*/
+static key_t non_leaf_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key);
+
+/*
+下一层节点满后分裂，建立新的父节点，添加键值
+struct bplus_tree *tree-------------B+树信息结构体
+struct bplus_node *l_ch-------------B+树左孩子节点
+struct bplus_node *r_ch-------------B+树右孩子节点
+key_t key---------------------------后继节点的键值
+*/
+static int parent_node_build(struct bplus_tree *tree, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key)
+{
+		/*左右节点均没有父节点*/
+        if (l_ch->parent == INVALID_OFFSET && r_ch->parent == INVALID_OFFSET) {
+                /*左右节点均没有父节点，建立新的父节点*/
                 struct bplus_node *parent = non_leaf_new(tree);
                 key(parent)[0] = key;
                 sub(parent)[0] = l_ch->self;
                 sub(parent)[1] = r_ch->self;
                 parent->children = 2;
+                if (tree->flags & BPLUS_TREE_COUNTS) {
+                        count(parent)[0] = node_total(l_ch);
+                        count(parent)[1] = node_total(r_ch);
+                }
 				
                 /*写入新的父节点，升级B+树信息结构体内的root根节点*/
                 tree->root = new_node_append(tree, parent);
@@ -434,908 +1833,4733 @@ static int parent_node_build(struct bplus_tree *tree, struct bplus_node *l_ch, s
                 r_ch->parent = parent->self;
                 tree->level++;
 				
-                /*操作完成，将父节点和子节点记入index*/
-                node_flush(tree, l_ch);
-                node_flush(tree, r_ch);
-                node_flush(tree, parent);
+                /*操作完成，将父节点和子节点记入index*/
+                node_flush(tree, l_ch);
+                node_flush(tree, r_ch);
+                node_flush(tree, parent);
+                return 0;
+		/*右节点没有父节点*/
+        } else if (r_ch->parent == INVALID_OFFSET) {
+				/*node_fetch(tree, l_ch->parent):从.index文件获取*/
+                return non_leaf_insert(tree, node_fetch(tree, l_ch->parent), l_ch, r_ch, key);
+        /*左节点没有父节点*/
+		} else {
+				/*node_fetch(tree, r_ch->parent):从.index文件获取*/
+                return non_leaf_insert(tree, node_fetch(tree, r_ch->parent), l_ch, r_ch, key);
+        }
+}
+
+/*
+非叶子节点的分裂插入
+insert在spilit左边,insert<spilit
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *node------------------原节点
+struct bplus_node *left------------------新分裂的节点
+struct bplus_node *l_ch------------------左孩子
+struct bplus_node *r_ch------------------右孩子
+key_t key--------------------------------键值
+int insert-------------------------------插入位置
+*/
+static key_t non_leaf_split_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+{
+        int i;
+        key_t split_key;
+
+        /*分裂边界spilit=(len+1)/2*/
+        int split = (_max_order + 1) / 2;
+
+        /*左节点添加到树*/
+        left_node_add(tree, node, left);
+
+        /*重新计算左右兄弟节点的孩子*/
+        int pivot = insert;
+        left->children = split;
+        node->children = _max_order - split + 1;
+
+        /*将原来的insert~spilit的key和data复制到分裂的左兄弟*/
+        memmove(&key(left)[0], &key(node)[0], pivot * sizeof(key_t));
+        memmove(&sub(left)[0], &sub(node)[0], pivot * sizeof(off_t));
+        count_move(tree, left, 0, node, 0, pivot);
+
+        /*将原来的insert+1~end的key和data后移1位，方便插入*/
+        memmove(&key(left)[pivot + 1], &key(node)[pivot], (split - pivot - 1) * sizeof(key_t));
+        memmove(&sub(left)[pivot + 1], &sub(node)[pivot], (split - pivot - 1) * sizeof(off_t));
+        count_move(tree, left, pivot + 1, node, pivot, split - pivot - 1);
+
+        /*将分裂的左节点的孩子重定向，写入.index*/
+        for (i = 0; i < left->children; i++) {
+                if (i != pivot && i != pivot + 1) {
+                        sub_node_flush(tree, left, sub(left)[i]);
+                }
+        }
+
+        /*插入新键和子节点，并找到拆分键*/
+        key(left)[pivot] = key;
+		/*
+		插入的非叶子节点有左右两孩子
+		判断他们在分裂边界的那一边
+		pivot == split - 1：孩子节点在分裂边界的两边
+		else：孩子节点均在分裂节点左边
+		*/
+        if (pivot == split - 1) {
+                /*
+				孩子节点在分裂边界的两边
+				更新索引，l_ch放到新分裂的非叶子节点
+				r_ch放到原非叶子节点
+				*/
+                sub_node_update(tree, left, pivot, l_ch);
+                sub_node_update(tree, node, 0, r_ch);
+                split_key = key;
+        } else {
+                /*
+				两个新的子节点在分裂左节点
+				更新索引，l_ch和r_ch均放到新分裂的非叶子节点
+				*/
+                sub_node_update(tree, left, pivot, l_ch);
+                sub_node_update(tree, left, pivot + 1, r_ch);
+                sub(node)[0] = sub(node)[split - 1];
+                count_move(tree, node, 0, node, split - 1, 1);
+                split_key = key(node)[split - 2];
+        }
+
+        /*将原节点分裂边界右边的key和ptr左移*/
+        memmove(&key(node)[0], &key(node)[split - 1], (node->children - 1) * sizeof(key_t));
+        memmove(&sub(node)[1], &sub(node)[split], (node->children - 1) * sizeof(off_t));
+        count_move(tree, node, 1, node, split, node->children - 1);
+
+		/*返回前继节点，作为上一层键值*/
+        return split_key;
+}
+
+/*
+非叶子节点的分裂插入
+insert与spilit重叠，insert==spilit
+直接分裂，移动操作减少
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *node------------------原节点
+struct bplus_node *right-----------------新分裂的节点
+struct bplus_node *l_ch------------------左孩子
+struct bplus_node *r_ch------------------右孩子
+key_t key--------------------------------键值
+int insert-------------------------------插入位置
+*/
+static key_t non_leaf_split_right1(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+{
+        int i;
+
+        /*分裂边界spilit=(len+1)/2*/
+        int split = (_max_order + 1) / 2;
+
+        /*新分裂的节点添加到树*/
+        right_node_add(tree, node, right);
+
+        /*上一层的键值*/
+        key_t split_key = key(node)[split - 1];
+
+        /*重新计算孩子个数*/
+        int pivot = 0;
+        node->children = split;
+        right->children = _max_order - split + 1;
+
+        /*插入key和ptr*/
+        key(right)[0] = key;
+        sub_node_update(tree, right, pivot, l_ch);
+        sub_node_update(tree, right, pivot + 1, r_ch);
+
+         /*复制数据到新的分裂节点*/
+        memmove(&key(right)[pivot + 1], &key(node)[split], (right->children - 2) * sizeof(key_t));
+        memmove(&sub(right)[pivot + 2], &sub(node)[split + 1], (right->children - 2) * sizeof(off_t));
+        count_move(tree, right, pivot + 2, node, split + 1, right->children - 2);
+
+        /*重定向父子结点，写入.index*/
+        for (i = pivot + 2; i < right->children; i++) {
+                sub_node_flush(tree, right, sub(right)[i]);
+        }
+
+		/*返回上一层键值*/
+        return split_key;
+}
+
+/*
+非叶子节点的分裂插入
+insert在spilit右边,insert>spilit
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *node------------------原节点
+struct bplus_node *right-----------------新分裂的节点
+struct bplus_node *l_ch------------------左孩子
+struct bplus_node *r_ch------------------右孩子
+key_t key--------------------------------键值
+int insert-------------------------------插入位置
+*/
+static key_t non_leaf_split_right2(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+{
+        int i;
+
+        /*分裂边界spilit=(len+1)/2*/
+        int split = (_max_order + 1) / 2;
+
+        /*右节点添加到树*/
+        right_node_add(tree, node, right);
+
+        /*上一层的键值*/
+        key_t split_key = key(node)[split];
+
+        /*重新计算孩子个数*/
+        int pivot = insert - split - 1;
+        node->children = split + 1;
+        right->children = _max_order - split;
+
+        /*复制数据到新的分裂节点*/
+        memmove(&key(right)[0], &key(node)[split + 1], pivot * sizeof(key_t));
+        memmove(&sub(right)[0], &sub(node)[split + 1], pivot * sizeof(off_t));
+        count_move(tree, right, 0, node, split + 1, pivot);
+
+        /*插入key和ptr，更新索引*/
+        key(right)[pivot] = key;
+        sub_node_update(tree, right, pivot, l_ch);
+        sub_node_update(tree, right, pivot + 1, r_ch);
+
+        /*将原节点insert+1~end的数据移动到新分裂的非叶子节点*/
+        memmove(&key(right)[pivot + 1], &key(node)[insert], (_max_order - insert - 1) * sizeof(key_t));
+        memmove(&sub(right)[pivot + 2], &sub(node)[insert + 1], (_max_order - insert - 1) * sizeof(off_t));
+        count_move(tree, right, pivot + 2, node, insert + 1, _max_order - insert - 1);
+
+        /*重定向父子结点，写入.index*/
+        for (i = 0; i < right->children; i++) {
+                if (i != pivot && i != pivot + 1) {
+                        sub_node_flush(tree, right, sub(right)[i]);
+                }
+        }
+
+		/*返回上一层键值*/
+        return split_key;
+}
+
+/*
+非叶子节点的追加分裂
+插入位置在最右非叶子节点的末尾，即顺序插入
+原节点保留_max_order-1个孩子，l_ch和r_ch放到新分裂的右节点，使顺序插入时非叶子节点接近全满
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *node------------------原节点
+struct bplus_node *right-----------------新分裂的节点
+struct bplus_node *l_ch------------------左孩子，原节点的最后一个孩子
+struct bplus_node *r_ch------------------右孩子
+key_t key--------------------------------键值
+*/
+static key_t non_leaf_split_append(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key)
+{
+        /*右节点添加到树*/
+        right_node_add(tree, node, right);
+
+        /*原节点最后一个键值作为上一层的键值*/
+        key_t split_key = key(node)[_max_order - 2];
+        node->children = _max_order - 1;
+        right->children = 2;
+
+        /*插入key和ptr，更新索引*/
+        key(right)[0] = key;
+        sub_node_update(tree, right, 0, l_ch);
+        sub_node_update(tree, right, 1, r_ch);
+
+        /*返回上一层键值*/
+        return split_key;
+}
+
+/*
+父节点未满时，非叶子节点的简单插入
+struct bplus_tree *tree----------------B+树信息结构体
+struct bplus_node *node----------------父节点
+struct bplus_node *l_ch----------------左孩子
+struct bplus_node *r_ch----------------右孩子
+key_t key------------------------------键值
+int insert-----------------------------插入位置
+*/
+static void non_leaf_simple_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+{
+		/*将insert处原来的值后移*/
+        memmove(&key(node)[insert + 1], &key(node)[insert], (node->children - 1 - insert) * sizeof(key_t));
+        memmove(&sub(node)[insert + 2], &sub(node)[insert + 1], (node->children - 1 - insert) * sizeof(off_t));
+        count_move(tree, node, insert + 2, node, insert + 1, node->children - 1 - insert);
+        
+		/*在insert处插入键值，并更新索引*/
+        key(node)[insert] = key;
+        sub_node_update(tree, node, insert, l_ch);
+        sub_node_update(tree, node, insert + 1, r_ch);
+        node->children++;
+}
+
+/*
+非叶子节点插入，定义
+即生成新的父节点
+struct bplus_tree *tree-------------B+树信息结构体
+struct bplus_node *node-------------要接入的新的B+树兄弟叶子节点
+struct bplus_node *l_ch-------------B+树左孩子节点
+struct bplus_node *r_ch-------------B+树右孩子节点
+key_t key
+*/
+static int non_leaf_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key)
+{
+        /*键值二分查找*/
+        int insert = key_binary_search(tree, node, key);
+        assert(insert < 0);
+        insert = -insert - 1;
+
+        /*父节点满，进行分裂*/
+        if (node->children == _max_order) {
+                key_t split_key;
+                /*分裂边界spilit=(len+1)/2*/
+                int split = (node->children + 1) / 2;
+				/*生成一个新的分裂的非叶子节点*/
+                struct bplus_node *sibling = non_leaf_new(tree);
+
+                /*顺序插入：插入位置在最右非叶子节点末尾，进行追加分裂*/
+                if (insert == node->children - 1 && node->next == INVALID_OFFSET) {
+                        split_key = non_leaf_split_append(tree, node, sibling, l_ch, r_ch, key);
+                        return parent_node_build(tree, node, sibling, split_key);
+                }
+
+                if (insert < split) {
+                        split_key = non_leaf_split_left(tree, node, sibling, l_ch, r_ch, key, insert);
+                } else if (insert == split) {
+                        split_key = non_leaf_split_right1(tree, node, sibling, l_ch, r_ch, key, insert);
+                } else {
+                        split_key = non_leaf_split_right2(tree, node, sibling, l_ch, r_ch, key, insert);
+                }
+
+                /*再次建立新的父节点*/
+                if (insert < split) {
+                        return parent_node_build(tree, sibling, node, split_key);
+                } else {
+                        return parent_node_build(tree, node, sibling, split_key);
+                }
+		/*父节点未满，进行简单的非叶子节点插入，并保存*/
+        } else {
+                non_leaf_simple_insert(tree, node, l_ch, r_ch, key, insert);
+                node_flush(tree, node);
+        }
+        return 0;
+}
+
+/*
+节点分裂插入，插入位置在分裂位置的左边
+与leaf_split_right类似
+struct bplus_tree *tree-----------B+树信息结构体
+struct bplus_node *leaf-----------B+树叶子节点
+struct bplus_node *left-----------新的叶子节点
+key_t key-------------------------键值
+long data-------------------------数据
+int insert------------------------插入位置
+*/
+static key_t leaf_split_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, key_t key, long data, int insert)
+{
+        /*数据移出叶子节点，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, leaf->self);
+        }
+        /*分裂边界split=(len+1)/2*/
+        int split = (leaf->children + 1) / 2;
+
+        /*节点分裂，设置左右兄弟叶子节点的指向*/
+        left_node_add(tree, leaf, left);
+
+		/*重新设置children的数值*/
+        int pivot = insert;
+        left->children = split;
+        leaf->children = _max_entries - split + 1;
+
+        /*
+		将原叶子节点key[0]-key[insert]的数值复制到左边分裂出的新的叶子节点
+		将原叶子节点data[0]-data[insert]的数值复制到左边分裂出的新的叶子节点
+		*/
+        memmove(&key(left)[0], &key(leaf)[0], pivot * sizeof(key_t));
+        memmove(&data(left)[0], &data(leaf)[0], pivot * sizeof(long));
+
+        /*在insert处插入新的key和data*/
+        key(left)[pivot] = key;
+        data(left)[pivot] = data;
+
+        /*从原叶子节点将insert到split的值放到新的叶子节点insert+1处*/
+        memmove(&key(left)[pivot + 1], &key(leaf)[pivot], (split - pivot - 1) * sizeof(key_t));
+        memmove(&data(left)[pivot + 1], &data(leaf)[pivot], (split - pivot - 1) * sizeof(long));
+
+        /*将原叶子节点insert+1~end的key和data复制到原叶子节点key[0]*/
+        memmove(&key(leaf)[0], &key(leaf)[split - 1], leaf->children * sizeof(key_t));
+        memmove(&data(leaf)[0], &data(leaf)[split - 1], leaf->children * sizeof(long));
+
+        if (tree->learned != NULL) {
+                learned_leaf_split(tree, leaf, left, 1);
+        }
+		
+		/*返回后继节点的key，即原叶子节点现在的key[0]*/
+        return key(leaf)[0];
+}
+
+/*
+节点分裂插入，插入位置在分裂位置的右边
+与leaf_split_left类似
+struct bplus_tree *tree-----------B+树信息结构体
+struct bplus_node *leaf-----------B+树叶子节点
+struct bplus_node *right----------新的叶子节点
+key_t key-------------------------键值
+long data-------------------------数据
+int insert------------------------插入位置
+*/
+static key_t leaf_split_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, key_t key, long data, int insert)
+{
+        /*数据移出叶子节点，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, leaf->self);
+        }
+        /*分裂边界split=(len+1)/2*/
+        int split = (leaf->children + 1) / 2;
+
+        /*节点分裂，设置左右兄弟叶子节点的指向*/
+        right_node_add(tree, leaf, right);
+
+        /*重新设置children的数值*/
+        int pivot = insert - split;
+        leaf->children = split;
+        right->children = _max_entries - split + 1;
+
+        /*将原叶子节点spilt~insert的key和data复制到右边分裂出的新的叶子节点*/
+        memmove(&key(right)[0], &key(leaf)[split], pivot * sizeof(key_t));
+        memmove(&data(right)[0], &data(leaf)[split], pivot * sizeof(long));
+
+        /*在insert处插入新的key和data*/
+        key(right)[pivot] = key;
+        data(right)[pivot] = data;
+
+        /*移动剩余的数据*/
+        memmove(&key(right)[pivot + 1], &key(leaf)[insert], (_max_entries - insert) * sizeof(key_t));
+        memmove(&data(right)[pivot + 1], &data(leaf)[insert], (_max_entries - insert) * sizeof(long));
+
+        if (tree->learned != NULL) {
+                learned_leaf_split(tree, leaf, right, 0);
+        }
+
+		/*返回后继节点的key，即分裂的叶子节点的key[0]*/
+        return key(right)[0];
+}
+
+/*
+叶子节点的追加分裂
+插入位置在最右叶子节点的末尾，即顺序插入
+原叶子节点保持全满，新建的右兄弟只存放新的key和data
+struct bplus_tree *tree-----------B+树信息结构体
+struct bplus_node *leaf-----------B+树叶子节点
+struct bplus_node *right----------新的叶子节点
+key_t key-------------------------键值
+long data-------------------------数据
+*/
+static key_t leaf_split_append(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, key_t key, long data)
+{
+        /*节点分裂，设置左右兄弟叶子节点的指向*/
+        right_node_add(tree, leaf, right);
+
+        key(right)[0] = key;
+        data(right)[0] = data;
+        right->children = 1;
+
+        if (tree->learned != NULL) {
+                learned_leaf_split(tree, leaf, right, 0);
+        }
+
+        /*返回后继节点的key，即新的键值*/
+        return key;
+}
+
+/*
+叶子节点在未满时的简单插入
+struct bplus_tree *tree--------------------B+树信息结构体
+struct bplus_node *leaf--------------------B+树节点结构体，要插入的位置的上一个节点
+key_t key----------------------------------键值
+long data----------------------------------数据
+int intsert--------------------------------要插入的节点位序
+两个memmove是将在insert之前的数据往后存放，使得数据能够插入
+*/
+static void leaf_simple_insert(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, long data, int insert)
+{
+        memmove(&key(leaf)[insert + 1], &key(leaf)[insert], (leaf->children - insert) * sizeof(key_t));
+        memmove(&data(leaf)[insert + 1], &data(leaf)[insert], (leaf->children - insert) * sizeof(long));
+        key(leaf)[insert] = key;
+        data(leaf)[insert] = data;
+        leaf->children++;
+}
+
+/*
+叶子节点满时，将溢出的数据移到左兄弟，避免分裂
+leaf加上新数据共children+1个，将与左兄弟数据个数差值的一半移到左兄弟
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *leaf------------------已满的叶子节点
+struct bplus_node *left------------------未满的左兄弟
+struct bplus_node *parent----------------父节点
+int parent_key_index---------------------左兄弟与leaf之间的键值在父节点的位置
+key_t key--------------------------------键值
+long data--------------------------------数据
+int insert-------------------------------插入位置
+*/
+static void leaf_overflow_to_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, key_t key, long data, int insert)
+{
+        /*数据移出叶子节点，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, leaf->self);
+        }
+        int move = (leaf->children + 1 - left->children) / 2;
+
+        if (insert < move) {
+                /*新数据也移到左兄弟：leaf前insert个数据，新数据，再接着move-insert-1个数据*/
+                memmove(&key(left)[left->children], &key(leaf)[0], insert * sizeof(key_t));
+                memmove(&data(left)[left->children], &data(leaf)[0], insert * sizeof(long));
+                key(left)[left->children + insert] = key;
+                data(left)[left->children + insert] = data;
+                memmove(&key(left)[left->children + insert + 1], &key(leaf)[insert], (move - insert - 1) * sizeof(key_t));
+                memmove(&data(left)[left->children + insert + 1], &data(leaf)[insert], (move - insert - 1) * sizeof(long));
+
+                /*leaf剩余数据左移*/
+                memmove(&key(leaf)[0], &key(leaf)[move - 1], (leaf->children - move + 1) * sizeof(key_t));
+                memmove(&data(leaf)[0], &data(leaf)[move - 1], (leaf->children - move + 1) * sizeof(long));
+                leaf->children -= move - 1;
+        } else {
+                /*leaf前move个数据移到左兄弟，新数据插入leaf*/
+                memmove(&key(left)[left->children], &key(leaf)[0], move * sizeof(key_t));
+                memmove(&data(left)[left->children], &data(leaf)[0], move * sizeof(long));
+                memmove(&key(leaf)[0], &key(leaf)[move], (leaf->children - move) * sizeof(key_t));
+                memmove(&data(leaf)[0], &data(leaf)[move], (leaf->children - move) * sizeof(long));
+                leaf->children -= move;
+                leaf_simple_insert(tree, leaf, key, data, insert - move);
+        }
+        left->children += move;
+
+        /*更新父节点的键值*/
+        key(parent)[parent_key_index] = key(leaf)[0];
+}
+
+/*
+叶子节点满时，将溢出的数据移到右兄弟，避免分裂
+leaf加上新数据共children+1个，将与右兄弟数据个数差值的一半移到右兄弟
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *leaf------------------已满的叶子节点
+struct bplus_node *right-----------------未满的右兄弟
+struct bplus_node *parent----------------父节点
+int parent_key_index---------------------leaf与右兄弟之间的键值在父节点的位置
+key_t key--------------------------------键值
+long data--------------------------------数据
+int insert-------------------------------插入位置
+*/
+static void leaf_overflow_to_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, struct bplus_node *parent, int parent_key_index, key_t key, long data, int insert)
+{
+        /*数据移出叶子节点，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, leaf->self);
+        }
+        int move = (leaf->children + 1 - right->children) / 2;
+        /*加上新数据后，从first开始的数据移到右兄弟*/
+        int first = leaf->children + 1 - move;
+
+        /*右兄弟腾出前move个位置*/
+        memmove(&key(right)[move], &key(right)[0], right->children * sizeof(key_t));
+        memmove(&data(right)[move], &data(right)[0], right->children * sizeof(long));
+
+        if (insert >= first) {
+                /*新数据也移到右兄弟*/
+                int pivot = insert - first;
+                memmove(&key(right)[0], &key(leaf)[first], pivot * sizeof(key_t));
+                memmove(&data(right)[0], &data(leaf)[first], pivot * sizeof(long));
+                key(right)[pivot] = key;
+                data(right)[pivot] = data;
+                memmove(&key(right)[pivot + 1], &key(leaf)[insert], (leaf->children - insert) * sizeof(key_t));
+                memmove(&data(right)[pivot + 1], &data(leaf)[insert], (leaf->children - insert) * sizeof(long));
+                leaf->children = first;
+        } else {
+                /*leaf最后move个数据移到右兄弟，新数据插入leaf*/
+                memmove(&key(right)[0], &key(leaf)[first - 1], move * sizeof(key_t));
+                memmove(&data(right)[0], &data(leaf)[first - 1], move * sizeof(long));
+                leaf->children = first - 1;
+                leaf_simple_insert(tree, leaf, key, data, insert);
+        }
+        right->children += move;
+
+        /*更新父节点的键值*/
+        key(parent)[parent_key_index] = key(right)[0];
+}
+
+/*
+叶子节点满时，先尝试将溢出的数据移到同一父节点下未满的兄弟节点(B*树)
+兄弟节点都满时才分裂，提高节点填充率
+返回-------------------------移到兄弟节点返回0，兄弟节点都满返回-1
+*/
+static int leaf_overflow_shift(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, long data, int insert)
+{
+        /*根节点没有兄弟*/
+        if (leaf->parent == INVALID_OFFSET) {
+                return -1;
+        }
+
+        struct bplus_node *parent = node_fetch(tree, leaf->parent);
+        int i = parent_key_index(tree, parent, key(leaf)[0]);
+
+        /*存在同一父节点下的左兄弟*/
+        if (i >= 0) {
+                struct bplus_node *l_sib = node_fetch(tree, leaf->prev);
+                if (l_sib->children < _max_entries) {
+                        leaf_overflow_to_left(tree, leaf, l_sib, parent, i, key, data, insert);
+                        count_sync(tree, parent, leaf);
+                        count_sync(tree, parent, l_sib);
+                        node_flush(tree, leaf);
+                        node_flush(tree, l_sib);
+                        node_flush(tree, parent);
+                        return 0;
+                }
+                cache_defer(tree, l_sib);
+        }
+
+        /*存在同一父节点下的右兄弟*/
+        if (i < parent->children - 2) {
+                struct bplus_node *r_sib = node_fetch(tree, leaf->next);
+                if (r_sib->children < _max_entries) {
+                        leaf_overflow_to_right(tree, leaf, r_sib, parent, i + 1, key, data, insert);
+                        count_sync(tree, parent, leaf);
+                        count_sync(tree, parent, r_sib);
+                        node_flush(tree, leaf);
+                        node_flush(tree, r_sib);
+                        node_flush(tree, parent);
+                        return 0;
+                }
+                cache_defer(tree, r_sib);
+        }
+
+        cache_defer(tree, parent);
+        return -1;
+}
+
+/*
+插入叶子节点
+struct bplus_tree *tree--------------------B+树信息结构体
+struct bplus_node *leaf--------------------B+树节点结构体，要插入的位置的上一个节点
+key_t key----------------------------------键值
+long data----------------------------------数据
+*/
+static int leaf_insert(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, long data)
+{
+        /*键值二分查找*/
+        int insert = key_binary_search(tree, leaf, key);
+		/*已存在键值*/
+        if (insert >= 0) {
+                return -1;
+        }
+        insert = -insert - 1;
+
+        /*从空闲节点缓存中获取*/
+        int i = ((char *) leaf - tree->caches) / _block_size;
+        tree->used[i] = 1;
+
+        /*叶子节点满*/
+        if (leaf->children == _max_entries) {
+                key_t split_key;
+				
+                /*节点分裂边界split=(len+1)/2*/
+                int split = (_max_entries + 1) / 2;
+                struct bplus_node *sibling;
+
+                /*顺序插入：插入位置在最右叶子节点末尾，进行追加分裂，原叶子节点保持全满*/
+                if (insert == leaf->children && leaf->next == INVALID_OFFSET) {
+                        sibling = leaf_new(tree);
+                        split_key = leaf_split_append(tree, leaf, sibling, key, data);
+                        return parent_node_build(tree, leaf, sibling, split_key);
+                }
+
+                /*兄弟节点未满，移出溢出的数据，无需分裂*/
+                if (leaf_overflow_shift(tree, leaf, key, data, insert) == 0) {
+                        return 0;
+                }
+
+                sibling = leaf_new(tree);
+
+                /*
+				由插入位置决定的兄弟叶复制
+				insert < split：插入位置在分裂位置的左边
+				insert >= split：插入位置在分裂位置的右边
+				返回后继节点，以放入父节点作为键值
+				*/
+                if (insert < split) {
+                        split_key = leaf_split_left(tree, leaf, sibling, key, data, insert);
+                } else {
+                        split_key = leaf_split_right(tree, leaf, sibling, key, data, insert);
+                }
+
+                /*建立新的父节点*/
+                if (insert < split) {
+                        return parent_node_build(tree, sibling, leaf, split_key);
+                } else {
+                        return parent_node_build(tree, leaf, sibling, split_key);
+                }
+		/*叶子节点未满*/
+        } else {
+                leaf_simple_insert(tree, leaf, key, data, insert);
+                leaf_flush_range(tree, leaf, insert, leaf->children);
+        }
+
+        return 0;
+}
+
+/*
+插入节点
+int upsert--------------------键值已存在时：0返回-1，1覆盖数据
+*/
+static int bplus_tree_insert(struct bplus_tree *tree, key_t key, long data, int upsert)
+{
+        struct bplus_node *node;
+
+        if (tree->hot != NULL) {
+                hot_invalidate(tree, key);
+        }
+
+        /*
+        键值可能已存在，重复加入过滤器不影响正确性
+        加入的键值超过容量2倍后误判率上升但结果仍然正确，由bplus_tree_maintain重建，插入时不遍历叶子节点
+        */
+        if (tree->bloom != NULL) {
+                bloom_add(tree, key);
+        }
+
+        /*
+        追加插入的快速路径
+        键值大于最右叶子节点的最大键值，一定属于最右叶子节点，直接插入，无需从根节点逐层查找
+        */
+        if (tree->tail != INVALID_OFFSET) {
+                node = node_seek(tree, tree->tail);
+                if (node->children > 0 && key > key(node)[node->children - 1]) {
+                        return leaf_insert(tree, node, key, data);
+                }
+        }
+
+        node = node_seek(tree, tree->root);
+        while (node != NULL) {
+				/*到达叶子节点*/
+                if (is_leaf(node)) {
+                        /*记住最右叶子节点*/
+                        if (node->next == INVALID_OFFSET) {
+                                tree->tail = node->self;
+                        }
+                        /*键值已存在，直接覆盖数据，只写一次区块*/
+                        if (upsert) {
+                                int i = key_binary_search(tree, node, key);
+                                if (i >= 0) {
+                                        /*多值模式下原来的值列表被替换*/
+                                        if (tree->flags & BPLUS_TREE_MULTI) {
+                                                posting_drop(tree, data(node)[i]);
+                                        }
+                                        data(node)[i] = data;
+                                        leaf_flush_range(tree, node, i, i + 1);
+                                        return 0;
+                                }
+                        }
+                        return leaf_insert(tree, node, key, data);
+				/*还未到达叶子节点，继续循环递归查找*/
+                } else {
+                        int i = key_binary_search(tree, node, key);
+                        if (i >= 0) {
+                                node = node_seek(tree, sub(node)[i + 1]);
+                        } else {
+                                i = -i - 1;
+                                node = node_seek(tree, sub(node)[i]);
+                        }
+                }
+        }
+
+        /*
+		创建新的叶子节点
+		在B+树后面跟随赋值key和data
+		添加key：key(root)[0] = key;
+		添加data：data(root)[0] = data;
+		插入树：tree->root = new_node_append(tree, root);
+		刷新缓冲区：node_flush(tree, root);
+		*/
+        struct bplus_node *root = leaf_new(tree);
+        key(root)[0] = key;
+        data(root)[0] = data;
+        root->children = 1;
+        tree->root = new_node_append(tree, root);
+        tree->tail = tree->root;
+        tree->level = 1;
+        node_flush(tree, root);
+        return 0;
+}
+
+/*
+struct bplus_node *l_sib------------------左兄弟
+struct bplus_node *r_sib------------------右兄弟
+struct bplus_node *parent-----------------父节点
+int i-------------------------------------键值在父节点中的位置
+*/
+static inline int sibling_select(struct bplus_node *l_sib, struct bplus_node *r_sib, struct bplus_node *parent, int i)
+{
+        if (i == -1) {
+                /*没有左兄弟，选择右兄弟合并*/
+                return RIGHT_SIBLING;
+        } else if (i == parent->children - 2) {
+                /*没有右兄弟，选择左兄弟*/
+                return LEFT_SIBLING;
+        } else {
+                /*有左右兄弟，选择孩子更多的节点*/
+                return l_sib->children >= r_sib->children ? LEFT_SIBLING : RIGHT_SIBLING;
+        }
+}
+
+/*
+非叶子节点从左兄弟拿一个值
+*/
+static void non_leaf_shift_from_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+{
+        memmove(&key(node)[1], &key(node)[0], remove * sizeof(key_t));
+        memmove(&sub(node)[1], &sub(node)[0], (remove + 1) * sizeof(off_t));
+        count_move(tree, node, 1, node, 0, remove + 1);
+
+        key(node)[0] = key(parent)[parent_key_index];
+        key(parent)[parent_key_index] = key(left)[left->children - 2];
+
+        sub(node)[0] = sub(left)[left->children - 1];
+
+        count_move(tree, node, 0, left, left->children - 1, 1);
+        sub_node_flush(tree, node, sub(node)[0]);
+
+        left->children--;
+}
+
+/*
+非叶子节点合并到左兄弟
+*/
+static void non_leaf_merge_into_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+{
+        /*键值下移*/
+        key(left)[left->children - 1] = key(parent)[parent_key_index];
+
+        memmove(&key(left)[left->children], &key(node)[0], remove * sizeof(key_t));
+        memmove(&sub(left)[left->children], &sub(node)[0], (remove + 1) * sizeof(off_t));
+        count_move(tree, left, left->children, node, 0, remove + 1);
+
+        memmove(&key(left)[left->children + remove], &key(node)[remove + 1], (node->children - remove - 2) * sizeof(key_t));
+        memmove(&sub(left)[left->children + remove + 1], &sub(node)[remove + 2], (node->children - remove - 2) * sizeof(off_t));
+        count_move(tree, left, left->children + remove + 1, node, remove + 2, node->children - remove - 2);
+
+        int i, j;
+        for (i = left->children, j = 0; j < node->children - 1; i++, j++) {
+                sub_node_flush(tree, left, sub(left)[i]);
+        }
+
+        left->children += node->children - 1;
+}
+
+/*
+非叶子节点从右兄弟拿一个值
+*/
+static void non_leaf_shift_from_right(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
+{
+        key(node)[node->children - 1] = key(parent)[parent_key_index];
+        key(parent)[parent_key_index] = key(right)[0];
+
+        sub(node)[node->children] = sub(right)[0];
+
+        count_move(tree, node, node->children, right, 0, 1);
+        sub_node_flush(tree, node, sub(node)[node->children]);
+        node->children++;
+
+        memmove(&key(right)[0], &key(right)[1], (right->children - 2) * sizeof(key_t));
+        memmove(&sub(right)[0], &sub(right)[1], (right->children - 1) * sizeof(off_t));
+        count_move(tree, right, 0, right, 1, right->children - 1);
+
+        right->children--;
+}
+
+/*
+非叶子节点合并到右兄弟
+*/
+static void non_leaf_merge_from_right(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
+{
+        key(node)[node->children - 1] = key(parent)[parent_key_index];
+        node->children++;
+
+        memmove(&key(node)[node->children - 1], &key(right)[0], (right->children - 1) * sizeof(key_t));
+        memmove(&sub(node)[node->children - 1], &sub(right)[0], right->children * sizeof(off_t));
+        count_move(tree, node, node->children - 1, right, 0, right->children);
+
+        int i, j;
+        for (i = node->children - 1, j = 0; j < right->children; i++, j++) {
+                sub_node_flush(tree, node, sub(node)[i]);
+        }
+
+        node->children += right->children - 1;
+}
+
+/*
+非叶子节点的简单删除
+*/
+static inline void non_leaf_simple_remove(struct bplus_tree *tree, struct bplus_node *node, int remove)
+{
+        assert(node->children >= 2);
+        memmove(&key(node)[remove], &key(node)[remove + 1], (node->children - remove - 2) * sizeof(key_t));
+        memmove(&sub(node)[remove + 1], &sub(node)[remove + 2], (node->children - remove - 2) * sizeof(off_t));
+        count_move(tree, node, remove + 1, node, remove + 2, node->children - remove - 2);
+        node->children--;
+}
+
+/*
+非叶子节点的删除操作
+叶子节点删除操作后，更新非叶子节点，非叶子节点的键值也可能被删除，非叶子节点也可能合并
+struct bplus_tree *tree---------------------B+树信息结构体
+struct bplus_node *node---------------------要执行删除操作的节点
+int remove----------------------------------要删除的键值位置
+*/
+static void non_leaf_remove(struct bplus_tree *tree, struct bplus_node *node, int remove)
+{
+		/*不存在父节点，要执行删除操作的节点是根节点*/
+        if (node->parent == INVALID_OFFSET) {
+                /*只有两个键值*/
+                if (node->children == 2) {
+                        /*用第一个子节点替换旧根节点*/
+                        struct bplus_node *root = node_fetch(tree, sub(node)[0]);
+                        root->parent = INVALID_OFFSET;
+                        tree->root = root->self;
+                        tree->level--;
+                        node_delete(tree, node, NULL, NULL);
+                        node_flush(tree, root);
+				/*键值大于2，将remove后的数据前移*/
+                } else {
+                        non_leaf_simple_remove(tree, node, remove);
+                        node_flush(tree, node);
+                }
+		/*存在父节点，且非叶子节点内含数据小于一半，也要进行合并操作*/
+        } else if (node->children <= (_max_order + 1) / 2) {
+                struct bplus_node *l_sib = node_fetch(tree, node->prev);
+                struct bplus_node *r_sib = node_fetch(tree, node->next);
+                struct bplus_node *parent = node_fetch(tree, node->parent);
+
+                int i = parent_key_index(tree, parent, key(node)[0]);
+
+                /*选择左兄弟合并*/
+                if (sibling_select(l_sib, r_sib, parent, i)  == LEFT_SIBLING) {
+						/*左兄弟节点内数据过半，无法合并，就拿一个数据过来*/
+                        if (l_sib->children > (_max_order + 1) / 2) {
+								/*左兄弟数据未过半，两两合并*/
+                                non_leaf_shift_from_left(tree, node, l_sib, parent, i, remove);
+                                count_sync(tree, parent, node);
+                                count_sync(tree, parent, l_sib);
+                                node_flush(tree, node);
+                                node_flush(tree, l_sib);
+                                node_flush(tree, r_sib);
+                                node_flush(tree, parent);
+						/*左兄弟数据未过半，两两合并*/
+                        } else {
+                                non_leaf_merge_into_left(tree, node, l_sib, parent, i, remove);
+                                count_sync(tree, parent, l_sib);
+                                node_delete(tree, node, l_sib, r_sib);
+                                non_leaf_remove(tree, parent, i);
+                        }
+				/*选择右兄弟合并*/
+                } else {
+                        /*在与兄弟节点合并时首先删除，以防溢出*/
+                        non_leaf_simple_remove(tree, node, remove);
+						
+						/*右兄弟节点内数据过半，无法合并，就拿一个数据过来*/
+                        if (r_sib->children > (_max_order + 1) / 2) {
+                                non_leaf_shift_from_right(tree, node, r_sib, parent, i + 1);
+                                count_sync(tree, parent, node);
+                                count_sync(tree, parent, r_sib);
+                                node_flush(tree, node);
+                                node_flush(tree, l_sib);
+                                node_flush(tree, r_sib);
+                                node_flush(tree, parent);
+						/*右兄弟数据未过半，两两合并*/
+                        } else {
+                                non_leaf_merge_from_right(tree, node, r_sib, parent, i + 1);
+                                count_sync(tree, parent, node);
+                                struct bplus_node *rr_sib = node_fetch(tree, r_sib->next);
+                                node_delete(tree, r_sib, node, rr_sib);
+                                node_flush(tree, l_sib);
+                                non_leaf_remove(tree, parent, i + 1);
+                        }
+                }
+		/*存在父节点，且非叶子节点内含数据大于一半，不需要进行合并操作*/
+        } else {
+                non_leaf_simple_remove(tree, node, remove);
+                node_flush(tree, node);
+        }
+}
+
+/*
+从左兄弟拿一个数据，来保持平衡
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *leaf------------------要执行删除操作和合并操作的叶子节点
+struct bplus_node *left------------------左兄弟
+struct bplus_node *parent----------------父节点
+int parent_key_index---------------------leaf在父节点的位置
+int remove-------------------------------删除的数据在leaf的位置
+*/
+static void leaf_shift_from_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+{
+        /*数据移出左兄弟，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, left->self);
+        }
+        /*腾出第一个位置*/
+        memmove(&key(leaf)[1], &key(leaf)[0], remove * sizeof(key_t));
+        memmove(&data(leaf)[1], &data(leaf)[0], remove * sizeof(off_t));
+
+        /*从左兄弟拿一个数据*/
+        key(leaf)[0] = key(left)[left->children - 1];
+        data(leaf)[0] = data(left)[left->children - 1];
+        left->children--;
+
+        /*更新父节点的键值*/
+        key(parent)[parent_key_index] = key(leaf)[0];
+}
+
+/*
+左兄弟数据未过半，两两合并
+*/
+static void leaf_merge_into_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, int parent_key_index, int remove)
+{
+        /*将key和data从leaf复制到left，不包括被删除的数据*/
+        memmove(&key(left)[left->children], &key(leaf)[0], remove * sizeof(key_t));
+        memmove(&data(left)[left->children], &data(leaf)[0], remove * sizeof(off_t));
+        memmove(&key(left)[left->children + remove], &key(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(key_t));
+        memmove(&data(left)[left->children + remove], &data(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(off_t));
+        left->children += leaf->children - 1;
+}
+
+/*
+从左兄弟拿一个数据，来保持平衡
+struct bplus_tree *tree------------------B+树信息结构体
+struct bplus_node *leaf------------------要执行删除操作和合并操作的叶子节点
+struct bplus_node *right-----------------右兄弟
+struct bplus_node *parent----------------父节点
+int parent_key_index---------------------leaf在父节点的位置
+int remove-------------------------------删除的数据在leaf的位置
+*/
+static void leaf_shift_from_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
+{
+        /*数据移出右兄弟，自适应哈希索引中指向它的键值失效*/
+        if (tree->ahi != NULL) {
+                ahi_leaf_drop(tree, right->self);
+        }
+        /*leaf最后一个位置放right第一个数据*/
+        key(leaf)[leaf->children] = key(right)[0];
+        data(leaf)[leaf->children] = data(right)[0];
+        leaf->children++;
+
+        /*right左移*/
+        memmove(&key(right)[0], &key(right)[1], (right->children - 1) * sizeof(key_t));
+        memmove(&data(right)[0], &data(right)[1], (right->children - 1) * sizeof(off_t));
+        right->children--;
+
+        /*更新父节点的键值*/
+        key(parent)[parent_key_index] = key(right)[0];
+}
+
+/*
+左兄弟数据未过半，两两合并
+*/
+static inline void leaf_merge_from_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right)
+{
+        memmove(&key(leaf)[leaf->children], &key(right)[0], right->children * sizeof(key_t));
+        memmove(&data(leaf)[leaf->children], &data(right)[0], right->children * sizeof(off_t));
+        leaf->children += right->children;
+}
+
+/*
+叶子节点的简单删除操作
+*/
+static inline void leaf_simple_remove(struct bplus_tree *tree, struct bplus_node *leaf, int remove)
+{
+		/*key和data左移覆盖被删除的key和data*/
+        memmove(&key(leaf)[remove], &key(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(key_t));
+        memmove(&data(leaf)[remove], &data(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(off_t));
+        leaf->children--;
+}
+
+/*
+叶子节点的删除操作
+struct bplus_tree *tree-----------------B+树信息结构体
+struct bplus_node *leaf-----------------要执行删除操作的叶子节点
+key_t key-------------------------------要删除的键值
+*/
+static int leaf_remove(struct bplus_tree *tree, struct bplus_node *leaf, key_t key)
+{
+        int remove = key_binary_search(tree, leaf, key);
+		/*要删除的键值不存在*/
+        if (remove < 0) {
+                return -1;
+        }
+
+        /*节点所在的缓存位置*/
+        int i = ((char *) leaf - tree->caches) / _block_size;
+        tree->used[i] = 1;
+		
+		/*父节点非法，即不存在父节点，要进行删除操作的叶子节点是根节点*/
+        if (leaf->parent == INVALID_OFFSET) {
+                /*节点内只有1个数据*/
+                if (leaf->children == 1) {
+                        /* delete the only last node */
+                        assert(key == key(leaf)[0]);
+                        tree->root = INVALID_OFFSET;
+                        tree->level = 0;
+						/*删除节点*/
+                        node_delete(tree, leaf, NULL, NULL);
+				/*节点内有多个数据*/
+                } else {
+                        leaf_simple_remove(tree, leaf, remove);
+                        leaf_flush_range(tree, leaf, remove, leaf->children);
+                }
+		/*
+		延迟删除模式，删除后数据不少于阈值
+		只删除不合并，前台只写一个叶子节点
+		刚变为欠满时加入待整理队列，由bplus_tree_maintain合并
+		*/
+        } else if (leaf->children <= (_max_entries + 1) / 2 && tree->lazy_threshold >= 0 &&
+                   leaf->children - 1 >= tree->lazy_threshold) {
+                if (leaf->children == (_max_entries + 1) / 2) {
+                        struct lazy_leaf *lazy = malloc(sizeof(*lazy));
+                        assert(lazy != NULL);
+                        lazy->offset = leaf->self;
+                        list_add_tail(&lazy->link, &tree->lazy_leaves);
+                }
+                leaf_simple_remove(tree, leaf, remove);
+                leaf_flush_range(tree, leaf, remove, leaf->children);
+		/*有父节点，删除后节点内数据过少，要进行合并操作*/
+        } else if (leaf->children <= (_max_entries + 1) / 2) {
+                struct bplus_node *l_sib = node_fetch(tree, leaf->prev);
+                struct bplus_node *r_sib = node_fetch(tree, leaf->next);
+                struct bplus_node *parent = node_fetch(tree, leaf->parent);
+
+                i = parent_key_index(tree, parent, key(leaf)[0]);
+
+                /*选择左兄弟合并*/
+                if (sibling_select(l_sib, r_sib, parent, i) == LEFT_SIBLING) {
+						/*左兄弟节点内数据过半，无法合并，就拿一个数据过来*/
+                        if (l_sib->children > (_max_entries + 1) / 2) {
+                                leaf_shift_from_left(tree, leaf, l_sib, parent, i, remove);
+                                count_sync(tree, parent, leaf);
+                                count_sync(tree, parent, l_sib);
+                                node_flush(tree, leaf);
+                                node_flush(tree, l_sib);
+                                node_flush(tree, r_sib);
+                                node_flush(tree, parent);
+						/*左兄弟数据未过半，合并*/
+                        } else {
+                                leaf_merge_into_left(tree, leaf, l_sib, i, remove);
+                                count_sync(tree, parent, l_sib);
+                                /*删除无意义的leaf*/
+                                node_delete(tree, leaf, l_sib, r_sib);
+                                /*更新父节点*/
+                                non_leaf_remove(tree, parent, i);
+                        }
+				/*选择右兄弟合并*/
+                } else {
+                        leaf_simple_remove(tree, leaf, remove);
+						
+						/*右兄弟节点内数据过半，无法合并，就拿一个数据过来*/
+                        if (r_sib->children > (_max_entries + 1) / 2) {
+                                leaf_shift_from_right(tree, leaf, r_sib, parent, i + 1);
+                                count_sync(tree, parent, leaf);
+                                count_sync(tree, parent, r_sib);
+                                /* flush leaves */
+                                node_flush(tree, leaf);
+                                node_flush(tree, l_sib);
+                                node_flush(tree, r_sib);
+                                node_flush(tree, parent);
+						/*右兄弟数据未过半，合并*/
+                        } else {
+                                leaf_merge_from_right(tree, leaf, r_sib);
+                                count_sync(tree, parent, leaf);
+                                /*删除无意义的leaf*/
+                                struct bplus_node *rr_sib = node_fetch(tree, r_sib->next);
+                                node_delete(tree, r_sib, leaf, rr_sib);
+                                node_flush(tree, l_sib);
+                                /*更新父节点*/
+                                non_leaf_remove(tree, parent, i + 1);
+                        }
+                }
+		/*有父节点，但删除后，节点内数据大于一半，不进行合并*/
+        } else {
+                leaf_simple_remove(tree, leaf, remove);
+                leaf_flush_range(tree, leaf, remove, leaf->children);
+        }
+
+        return 0;
+}
+
+/*
+欠满叶子节点的整理，与leaf_remove的合并操作相同，但不删除数据
+叶子节点可能为空
+左兄弟或右兄弟数据过半就借数据，使两者数据个数平均，否则合并
+struct bplus_tree *tree-----------------B+树信息结构体
+struct bplus_node *leaf-----------------欠满的叶子节点
+*/
+static void leaf_rebalance(struct bplus_tree *tree, struct bplus_node *leaf)
+{
+        int move;
+
+        /*数据已经不欠满*/
+        if (leaf->children >= (_max_entries + 1) / 2) {
+                cache_defer(tree, leaf);
+                return;
+        }
+
+        /*根节点，只有为空时才删除*/
+        if (leaf->parent == INVALID_OFFSET) {
+                if (leaf->children == 0) {
+                        tree->root = INVALID_OFFSET;
+                        tree->level = 0;
+                        node_delete(tree, leaf, NULL, NULL);
+                } else {
+                        cache_defer(tree, leaf);
+                }
+                return;
+        }
+
+        struct bplus_node *l_sib = node_fetch(tree, leaf->prev);
+        struct bplus_node *r_sib = node_fetch(tree, leaf->next);
+        struct bplus_node *parent = node_fetch(tree, leaf->parent);
+
+        /*叶子节点可能为空，不能用键值查找位置*/
+        int i = parent_sub_index(parent, leaf->self) - 1;
+
+        /*选择左兄弟*/
+        if (sibling_select(l_sib, r_sib, parent, i) == LEFT_SIBLING) {
+                /*左兄弟数据过半，借一半差值过来*/
+                if (l_sib->children > (_max_entries + 1) / 2) {
+                        move = (l_sib->children - leaf->children) / 2;
+                        memmove(&key(leaf)[move], &key(leaf)[0], leaf->children * sizeof(key_t));
+                        memmove(&data(leaf)[move], &data(leaf)[0], leaf->children * sizeof(long));
+                        memmove(&key(leaf)[0], &key(l_sib)[l_sib->children - move], move * sizeof(key_t));
+                        memmove(&data(leaf)[0], &data(l_sib)[l_sib->children - move], move * sizeof(long));
+                        leaf->children += move;
+                        l_sib->children -= move;
+                        key(parent)[i] = key(leaf)[0];
+                        count_sync(tree, parent, leaf);
+                        count_sync(tree, parent, l_sib);
+                        node_flush(tree, leaf);
+                        node_flush(tree, l_sib);
+                        node_flush(tree, r_sib);
+                        node_flush(tree, parent);
+                /*左兄弟数据未过半，合并到左兄弟*/
+                } else {
+                        memmove(&key(l_sib)[l_sib->children], &key(leaf)[0], leaf->children * sizeof(key_t));
+                        memmove(&data(l_sib)[l_sib->children], &data(leaf)[0], leaf->children * sizeof(long));
+                        l_sib->children += leaf->children;
+                        count_sync(tree, parent, l_sib);
+                        node_delete(tree, leaf, l_sib, r_sib);
+                        non_leaf_remove(tree, parent, i);
+                }
+        /*选择右兄弟*/
+        } else {
+                /*右兄弟数据过半，借一半差值过来*/
+                if (r_sib->children > (_max_entries + 1) / 2) {
+                        move = (r_sib->children - leaf->children) / 2;
+                        memmove(&key(leaf)[leaf->children], &key(r_sib)[0], move * sizeof(key_t));
+                        memmove(&data(leaf)[leaf->children], &data(r_sib)[0], move * sizeof(long));
+                        memmove(&key(r_sib)[0], &key(r_sib)[move], (r_sib->children - move) * sizeof(key_t));
+                        memmove(&data(r_sib)[0], &data(r_sib)[move], (r_sib->children - move) * sizeof(long));
+                        leaf->children += move;
+                        r_sib->children -= move;
+                        key(parent)[i + 1] = key(r_sib)[0];
+                        count_sync(tree, parent, leaf);
+                        count_sync(tree, parent, r_sib);
+                        node_flush(tree, leaf);
+                        node_flush(tree, l_sib);
+                        node_flush(tree, r_sib);
+                        node_flush(tree, parent);
+                /*右兄弟数据未过半，合并右兄弟*/
+                } else {
+                        leaf_merge_from_right(tree, leaf, r_sib);
+                        count_sync(tree, parent, leaf);
+                        struct bplus_node *rr_sib = node_fetch(tree, r_sib->next);
+                        node_delete(tree, r_sib, leaf, rr_sib);
+                        node_flush(tree, l_sib);
+                        non_leaf_remove(tree, parent, i + 1);
+                }
+        }
+}
+
+/*
+删除节点
+*/
+static int bplus_tree_delete(struct bplus_tree *tree, key_t key)
+{
+        if (tree->hot != NULL) {
+                hot_invalidate(tree, key);
+        }
+
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+				/*叶子节点，直接进行删除操作*/
+                if (is_leaf(node)) {
+                        return leaf_remove(tree, node, key);
+				/*非叶子节点，继续循环递归查找*/
+                } else {
+                        int i = key_binary_search(tree, node, key);
+                        if (i >= 0) {
+                                node = node_seek(tree, sub(node)[i + 1]);
+                        } else {
+                                i = -i - 1;
+                                node = node_seek(tree, sub(node)[i]);
+                        }
+                }
+        }
+        return -1;
+}
+
+/*
+查找结点的入口
+值日志模式下数据是编码后的偏移量和长度，返回-1，值由bplus_tree_get_value读取
+*/
+long bplus_tree_get(struct bplus_tree *tree, key_t key)
+{
+        if (tree->flags & BPLUS_TREE_VLOG) {
+                return -1;
+        }
+
+        long data = bplus_tree_search(tree, key);
+        /*多值模式下返回最小的值*/
+        if (is_posting(data) && (tree->flags & BPLUS_TREE_MULTI)) {
+                struct posting_page *page = (struct posting_page *) tree->post_buf;
+                posting_read(tree, posting_decode(data), page);
+                data = page->first;
+        }
+        return data;
+}
+
+/*
+批量查找的排序比较，键值相同时保持原来的顺序
+*/
+static int batch_compare(const void *a, const void *b)
+{
+        const struct batch_lookup *x = a, *y = b;
+        if (x->key != y->key) {
+                return x->key < y->key ? -1 : 1;
+        }
+        return x->index - y->index;
+}
+
+/*
+预读批量查找在当前层接下来要读取的一组节点
+从第from个查找开始，最多预读BATCH_PREFETCH个不同的节点，偏移量连续的节点合并为一次请求
+返回--------------------------这一组之后第一个查找的位置
+*/
+static int batch_prefetch(struct bplus_tree *tree, struct batch_lookup *batch, int from, int n)
+{
+        off_t start = INVALID_OFFSET, len = 0, last = INVALID_OFFSET;
+        int nodes = 0;
+
+        for (; from < n; from++) {
+                off_t offset = batch[from].offset;
+                if (offset == INVALID_OFFSET || offset == last) {
+                        continue;
+                }
+                if (nodes == BATCH_PREFETCH) {
+                        break;
+                }
+                last = offset;
+                nodes++;
+                if (start != INVALID_OFFSET && offset == start + len) {
+                        len += _block_size;
+                        continue;
+                }
+                if (start != INVALID_OFFSET) {
+                        posix_fadvise(tree->fd, start, len, POSIX_FADV_WILLNEED);
+                }
+                start = offset;
+                len = _block_size;
+        }
+        if (start != INVALID_OFFSET) {
+                posix_fadvise(tree->fd, start, len, POSIX_FADV_WILLNEED);
+        }
+        return from;
+}
+
+/*
+批量查找，多个独立的查找按层交错进行
+查找按键值排序后逐层下降，同一层相同的节点只读取一次
+读取一组节点之前先预读下一组，读取和内核的I/O重叠，不再是逐个查找的串行读取
+key_t *keys-------------------要查找的键值
+long *data--------------------每个键值的数据，不存在为-1
+int n-------------------------键值个数
+返回--------------------------找到的键值个数
+和bplus_tree_get一样，值日志模式下数据全部为-1，值由bplus_tree_get_value读取
+*/
+int bplus_tree_get_batch(struct bplus_tree *tree, key_t *keys, long *data, int n)
+{
+        struct batch_lookup *batch;
+        int i, m = 0, found = 0;
+
+        if (n <= 0) {
+                return 0;
+        }
+        if (tree->flags & BPLUS_TREE_VLOG) {
+                for (i = 0; i < n; i++) {
+                        data[i] = -1;
+                }
+                return 0;
+        }
+        batch = malloc(n * sizeof(*batch));
+        assert(batch != NULL);
+
+        /*热点缓存命中和过滤器判断不存在的键值不参与查找*/
+        for (i = 0; i < n; i++) {
+                data[i] = -1;
+                if (tree->hot != NULL) {
+                        unsigned long h = key_hash(keys[i]);
+                        struct hot_shard *shard = hot_shard_of(tree, h);
+                        int j = hot_find(shard, keys[i], h);
+                        if (j >= 0) {
+                                shard->entries[j].ref = 1;
+                                shard->hits++;
+                                data[i] = shard->entries[j].data;
+                                continue;
+                        }
+                        shard->misses++;
+                }
+                if (tree->bloom != NULL) {
+                        tree->bloom_lookups++;
+                        if (!bloom_test(tree, keys[i])) {
+                                tree->bloom_negatives++;
+                                continue;
+                        }
+                }
+                batch[m].key = keys[i];
+                batch[m].index = i;
+                batch[m].offset = tree->root;
+                m++;
+        }
+        qsort(batch, m, sizeof(*batch), batch_compare);
+
+        /*所有叶子节点在同一层，到达叶子节点的那一层结束*/
+        while (m > 0 && tree->root != INVALID_OFFSET) {
+                struct bplus_node *node = NULL;
+                off_t last = INVALID_OFFSET;
+                int group = 0, ahead = batch_prefetch(tree, batch, 0, m), leaf = 0;
+
+                for (i = 0; i < m; i++) {
+                        struct batch_lookup *b = &batch[i];
+                        /*开始读取一组节点时预读下一组*/
+                        if (i == group) {
+                                group = ahead;
+                                ahead = batch_prefetch(tree, batch, ahead, m);
+                        }
+                        if (b->offset != last) {
+                                node = node_seek(tree, b->offset);
+                                last = b->offset;
+                        }
+
+                        int k = key_binary_search(tree, node, b->key);
+                        if (is_leaf(node)) {
+                                leaf = 1;
+                                if (k >= 0) {
+                                        data[b->index] = data(node)[k];
+                                        /*相同的键值排序后相邻，只加入热点缓存一次*/
+                                        if (tree->hot != NULL && (i == 0 || batch[i - 1].key != b->key)) {
+                                                hot_insert(tree, b->key, data(node)[k]);
+                                        }
+                                } else if (tree->bloom != NULL) {
+                                        tree->bloom_false++;
+                                }
+                        } else {
+                                b->offset = sub(node)[k >= 0 ? k + 1 : -k - 1];
+                        }
+                }
+                if (leaf) {
+                        break;
+                }
+        }
+        free(batch);
+
+        for (i = 0; i < n; i++) {
+                /*多值模式下返回最小的值*/
+                if (is_posting(data[i]) && (tree->flags & BPLUS_TREE_MULTI)) {
+                        struct posting_page *page = (struct posting_page *) tree->post_buf;
+                        posting_read(tree, posting_decode(data[i]), page);
+                        data[i] = page->first;
+                }
+                if (data[i] != -1) {
+                        found++;
+                }
+        }
+        return found;
+}
+
+/*
+设置热点缓存，缓存点查找的结果，由插入、删除和更新使缓存失效
+缓存分成多个分片，每个分片有自己的哈希表和CLOCK指针，淘汰时只扫描一个分片
+long capacity-----------------缓存的键值个数，小于等于0时关闭缓存
+int shards--------------------分片个数，向上取2的幂
+*/
+void bplus_tree_hot_cache(struct bplus_tree *tree, long capacity, int shards)
+{
+        int s;
+
+        if (tree->hot != NULL) {
+                for (s = 0; s < tree->hot_shards; s++) {
+                        free(tree->hot[s].entries);
+                        free(tree->hot[s].buckets);
+                }
+                free(tree->hot);
+                tree->hot = NULL;
+                tree->hot_shards = 0;
+        }
+        if (capacity <= 0) {
+                return;
+        }
+
+        tree->hot_shards = 1;
+        while (tree->hot_shards < shards && tree->hot_shards < capacity) {
+                tree->hot_shards <<= 1;
+        }
+        tree->hot = calloc(tree->hot_shards, sizeof(struct hot_shard));
+        assert(tree->hot != NULL);
+        for (s = 0; s < tree->hot_shards; s++) {
+                struct hot_shard *shard = &tree->hot[s];
+                shard->capacity = (capacity + tree->hot_shards - 1) / tree->hot_shards;
+                shard->nbuckets = shard->capacity;
+                shard->free = -1;
+                shard->entries = calloc(shard->capacity, sizeof(struct hot_entry));
+                shard->buckets = malloc(shard->nbuckets * sizeof(int));
+                assert(shard->entries != NULL && shard->buckets != NULL);
+                memset(shard->buckets, -1, shard->nbuckets * sizeof(int));
+        }
+}
+
+/*
+设置自适应哈希索引
+统计查找到达的叶子节点，访问较多的叶子节点把键值加入内存中的哈希表，之后查找这些键值直接读取叶子节点
+叶子节点的数据移到其他节点或者区块被释放时删除指向它的键值
+long capacity-----------------最多索引的键值个数，小于等于0时关闭，用完时清空重新统计
+*/
+void bplus_tree_adaptive_hash(struct bplus_tree *tree, long capacity)
+{
+        struct adaptive_hash *ahi = tree->ahi;
+
+        if (ahi != NULL) {
+                free(ahi->entries);
+                free(ahi->buckets);
+                free(ahi->leaves);
+                free(ahi->leaf_buckets);
+                free(ahi);
+                tree->ahi = NULL;
+        }
+        if (capacity <= 0) {
+                return;
+        }
+
+        ahi = calloc(1, sizeof(*ahi));
+        assert(ahi != NULL);
+        ahi->capacity = capacity;
+        /*每个叶子节点至少有一个键值，记录的叶子节点比键值少*/
+        ahi->leaf_capacity = capacity / 4 + 1;
+        ahi->entries = malloc(ahi->capacity * sizeof(struct ahi_entry));
+        ahi->buckets = malloc(ahi->capacity * sizeof(int));
+        ahi->leaves = malloc(ahi->leaf_capacity * sizeof(struct ahi_leaf));
+        ahi->leaf_buckets = malloc(ahi->leaf_capacity * sizeof(int));
+        assert(ahi->entries != NULL && ahi->buckets != NULL && ahi->leaves != NULL && ahi->leaf_buckets != NULL);
+        ahi_reset(ahi);
+        ahi->resets = 0;
+        tree->ahi = ahi;
+}
+
+/*
+自适应哈希索引的统计信息
+*/
+void bplus_tree_adaptive_hash_stats(struct bplus_tree *tree, struct bplus_ahi_stats *stats)
+{
+        struct adaptive_hash *ahi = tree->ahi;
+        int i;
+
+        memset(stats, 0, sizeof(*stats));
+        if (ahi == NULL) {
+                return;
+        }
+        stats->capacity = ahi->capacity;
+        stats->keys = ahi->count;
+        for (i = ahi->free; i >= 0; i = ahi->entries[i].lnext) {
+                stats->keys--;
+        }
+        for (i = 0; i < ahi->leaf_count; i++) {
+                if (ahi->leaves[i].offset != INVALID_OFFSET && ahi->leaves[i].hits >= AHI_HOT_HITS) {
+                        stats->leaves++;
+                }
+        }
+        stats->hits = ahi->hits;
+        stats->misses = ahi->misses;
+        stats->drops = ahi->drops;
+        stats->resets = ahi->resets;
+}
+
+/*
+设置学习索引
+沿叶子节点链表建立叶子节点第一个键值的数组，拟合分段线性模型，点查找只读取预测的叶子节点
+叶子节点分裂或释放时增量修改数组，偏差超过eps时重新拟合
+int eps-----------------------模型的最大误差，小于等于0时关闭学习索引
+返回--------------------------模型的段数
+*/
+long bplus_tree_learned_build(struct bplus_tree *tree, int eps)
+{
+        struct learned_index *li = tree->learned;
+
+        if (li != NULL) {
+                free(li->keys);
+                free(li->leaves);
+                free(li->segs);
+                free(li);
+                tree->learned = NULL;
+        }
+        if (eps <= 0) {
+                return 0;
+        }
+
+        li = calloc(1, sizeof(*li));
+        assert(li != NULL);
+        li->eps = eps;
+        tree->learned = li;
+        learned_rebuild(tree);
+        return li->nsegs;
+}
+
+/*
+学习索引的统计信息
+*/
+void bplus_tree_learned_stats(struct bplus_tree *tree, struct bplus_learned_stats *stats)
+{
+        struct learned_index *li = tree->learned;
+
+        memset(stats, 0, sizeof(*stats));
+        if (li == NULL) {
+                return;
+        }
+        stats->leaves = li->n;
+        stats->segments = li->nsegs;
+        stats->eps = li->eps;
+        stats->drift = li->drift;
+        stats->hits = li->hits;
+        stats->misses = li->misses;
+        stats->refits = li->refits;
+        stats->rebuilds = li->rebuilds;
+}
+
+/*
+设置节点内的查找方式
+int mode----------------------BPLUS_SEARCH_BINARY：二分查找(默认)
+                              BPLUS_SEARCH_INTERPOLATION：插值查找，探测几次后二分查找
+                              BPLUS_SEARCH_AUTO：每个节点根据键值分布选择
+*/
+void bplus_tree_search_mode(struct bplus_tree *tree, int mode)
+{
+        tree->search_mode = mode;
+}
+
+/*
+节点内查找的统计信息，reset为1时读取后清零
+只统计调用B+树接口的线程中的查找，快照和并行扫描在其他线程中的读取不统计
+*/
+void bplus_tree_search_stats(struct bplus_tree *tree, struct bplus_search_stats *stats, int reset)
+{
+        *stats = tree->search_stats;
+        if (reset) {
+                memset(&tree->search_stats, 0, sizeof(tree->search_stats));
+        }
+}
+
+/*
+节点写入的统计信息
+int reset---------------------读取后清零
+*/
+void bplus_tree_write_stats(struct bplus_tree *tree, struct bplus_write_stats *stats, int reset)
+{
+        stats->full_writes = tree->write_full;
+        stats->partial_writes = tree->write_partial;
+        stats->bytes = tree->write_bytes;
+        if (reset) {
+                tree->write_full = tree->write_partial = tree->write_bytes = 0;
+        }
+}
+
+/*
+热点缓存的统计信息，各分片之和
+*/
+void bplus_tree_hot_stats(struct bplus_tree *tree, struct bplus_hot_stats *stats)
+{
+        int s, i;
+
+        memset(stats, 0, sizeof(*stats));
+        for (s = 0; s < tree->hot_shards; s++) {
+                struct hot_shard *shard = &tree->hot[s];
+                stats->capacity += shard->capacity;
+                for (i = 0; i < shard->count; i++) {
+                        stats->entries += shard->entries[i].used;
+                }
+                stats->hits += shard->hits;
+                stats->misses += shard->misses;
+                stats->evictions += shard->evictions;
+        }
+}
+
+/*
+布隆过滤器文件的名字，和.index在同一目录
+*/
+static void bloom_name(struct bplus_tree *tree, char *name, int size)
+{
+        /*tree->filename以.boot结尾*/
+        snprintf(name, size, "%.*s.bloom", (int) strlen(tree->filename) - 5, tree->filename);
+}
+
+/*
+释放布隆过滤器
+*/
+void bplus_tree_bloom_drop(struct bplus_tree *tree)
+{
+        free(tree->bloom);
+        tree->bloom = NULL;
+        tree->bloom_bits = 0;
+        tree->bloom_hashes = 0;
+        tree->bloom_keys = 0;
+        tree->bloom_capacity = 0;
+}
+
+/*
+沿叶子节点链表建立或者重建布隆过滤器，之后点查找先查询过滤器
+删除键值不会清除过滤器中的位，删除较多后误判率上升，需要重建
+long capacity-----------------预计的键值个数，小于等于0时为现有键值个数的2倍，至少1024
+int bits_per_key--------------每个键值占用的位数，10位时误判率约1%
+返回--------------------------过滤器中的键值个数
+*/
+long bplus_tree_bloom_build(struct bplus_tree *tree, long capacity, int bits_per_key)
+{
+        struct bplus_node *node;
+        long keys = 0;
+
+        if (bits_per_key <= 0) {
+                bits_per_key = BLOOM_BITS_PER_KEY;
+        }
+        if (capacity <= 0) {
+                for (node = leaf_first(tree); node != NULL; node = node_seek(tree, node->next)) {
+                        keys += node->children;
+                }
+                capacity = keys * 2;
+        }
+        if (capacity < BLOOM_MIN_KEYS) {
+                capacity = BLOOM_MIN_KEYS;
+        }
+
+        bplus_tree_bloom_drop(tree);
+        tree->bloom_capacity = capacity;
+        tree->bloom_bits = capacity * bits_per_key;
+        /*最优哈希个数约为bits_per_key*ln2*/
+        tree->bloom_hashes = (bits_per_key * 69 + 50) / 100;
+        if (tree->bloom_hashes < 1) {
+                tree->bloom_hashes = 1;
+        }
+        if (tree->bloom_hashes > BLOOM_MAX_HASHES) {
+                tree->bloom_hashes = BLOOM_MAX_HASHES;
+        }
+        tree->bloom = calloc((tree->bloom_bits + 7) / 8, 1);
+        assert(tree->bloom != NULL);
+        tree->bloom_lookups = tree->bloom_negatives = tree->bloom_false = 0;
+
+        for (node = leaf_first(tree); node != NULL; node = node_seek(tree, node->next)) {
+                int i;
+                for (i = 0; i < node->children; i++) {
+                        bloom_add(tree, key(node)[i]);
+                }
+        }
+        return tree->bloom_keys;
+}
+
+/*
+布隆过滤器的统计信息
+预计误判率由置位比例计算：(置位比例)^哈希个数
+实际误判率为误判次数/(误判次数+过滤掉的次数)
+*/
+void bplus_tree_bloom_stats(struct bplus_tree *tree, struct bplus_bloom_stats *stats)
+{
+        long i, set = 0;
+        int k;
+
+        memset(stats, 0, sizeof(*stats));
+        if (tree->bloom == NULL) {
+                return;
+        }
+
+        for (i = 0; i < (tree->bloom_bits + 7) / 8; i++) {
+                set += __builtin_popcount(tree->bloom[i]);
+        }
+        stats->bits = tree->bloom_bits;
+        stats->hashes = tree->bloom_hashes;
+        stats->keys = tree->bloom_keys;
+        stats->lookups = tree->bloom_lookups;
+        stats->negatives = tree->bloom_negatives;
+        stats->false_positives = tree->bloom_false;
+        stats->fpr_expected = 1.0;
+        for (k = 0; k < tree->bloom_hashes; k++) {
+                stats->fpr_expected *= (double) set / tree->bloom_bits;
+        }
+        if (tree->bloom_false + tree->bloom_negatives > 0) {
+                stats->fpr_observed = (double) tree->bloom_false / (tree->bloom_false + tree->bloom_negatives);
+        }
+}
+
+/*
+保存布隆过滤器到.bloom
+文件头依次为位数、哈希个数、键值个数、容量，之后是位图
+*/
+static void bloom_store(struct bplus_tree *tree)
+{
+        char name[1024];
+        long header[4];
+
+        bloom_name(tree, name, sizeof(name));
+        if (tree->bloom == NULL) {
+                return;
+        }
+        int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+                return;
+        }
+        header[0] = tree->bloom_bits;
+        header[1] = tree->bloom_hashes;
+        header[2] = tree->bloom_keys;
+        header[3] = tree->bloom_capacity;
+        long len = (tree->bloom_bits + 7) / 8;
+        int ok = write(fd, header, sizeof(header)) == sizeof(header) && write(fd, tree->bloom, len) == len;
+        close(fd);
+        /*写入不完整的文件不能加载，下次打开时重建*/
+        if (!ok) {
+                unlink(name);
+        }
+}
+
+/*
+加载.bloom，加载后删除文件
+B+树没有正常关闭时过滤器可能漏掉之后插入的键值，下次打开时没有过滤器，需要重建
+*/
+static void bloom_load(struct bplus_tree *tree)
+{
+        char name[1024];
+        long header[4];
+
+        bloom_name(tree, name, sizeof(name));
+        int fd = open(name, O_RDONLY);
+        if (fd < 0) {
+                return;
+        }
+        if (read(fd, header, sizeof(header)) == sizeof(header) && header[0] > 0 &&
+            header[1] > 0 && header[1] <= BLOOM_MAX_HASHES && header[3] > 0) {
+                long len = (header[0] + 7) / 8;
+                tree->bloom = malloc(len);
+                assert(tree->bloom != NULL);
+                if (read(fd, tree->bloom, len) == len) {
+                        tree->bloom_bits = header[0];
+                        tree->bloom_hashes = header[1];
+                        tree->bloom_keys = header[2];
+                        tree->bloom_capacity = header[3];
+                } else {
+                        bplus_tree_bloom_drop(tree);
+                }
+        }
+        close(fd);
+        unlink(name);
+}
+
+/*
+处理节点入口
+插入节点
+删除节点
+*/
+int bplus_tree_put(struct bplus_tree *tree, key_t key, long data)
+{
+        int ret;
+        /*值日志模式下通过bplus_tree_put_value插入*/
+        if ((tree->flags & BPLUS_TREE_VLOG) && data) {
+                return -1;
+        }
+        if (tree->flags & BPLUS_TREE_MULTI) {
+                /*多值模式下插入是向键值的值列表追加，删除是删除键值和全部值*/
+                if (data) {
+                        return bplus_tree_multi_add(tree, key, data);
+                }
+                posting_drop(tree, bplus_tree_search(tree, key));
+        }
+        if (data) {
+                ret = bplus_tree_insert(tree, key, data, 0);
+        } else {
+                ret = bplus_tree_delete(tree, key);
+        }
+        if (ret == 0) {
+                count_path_fix(tree, key);
+        }
+        return ret;
+}
+
+/*
+原地覆盖已存在键值的数据，多值模式下释放原来的值列表
+*/
+static int data_update(struct bplus_tree *tree, key_t key, long data)
+{
+        if (tree->hot != NULL) {
+                hot_invalidate(tree, key);
+        }
+
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+                int i = key_binary_search(tree, node, key);
+                if (is_leaf(node)) {
+                        if (i < 0) {
+                                return -1;
+                        }
+                        if (tree->flags & BPLUS_TREE_MULTI) {
+                                posting_drop(tree, data(node)[i]);
+                        }
+                        data(node)[i] = data;
+                        leaf_flush_range(tree, node, i, i + 1);
+                        return 0;
+                } else {
+                        if (i >= 0) {
+                                node = node_seek(tree, sub(node)[i + 1]);
+                        } else {
+                                i = -i - 1;
+                                node = node_seek(tree, sub(node)[i]);
+                        }
+                }
+        }
+        return -1;
+}
+
+/*
+原地更新已存在键值的数据
+只查找一次叶子节点，直接覆盖数据并写回，不经过删除和插入，不会引起合并或分裂
+数据可以为0，多值模式下替换整个值列表，数据不能小于0，值日志模式下不能使用
+返回--------------------------成功返回0，键值不存在返回-1
+*/
+int bplus_tree_update(struct bplus_tree *tree, key_t key, long data)
+{
+        if (((tree->flags & BPLUS_TREE_MULTI) && data < 0) || (tree->flags & BPLUS_TREE_VLOG)) {
+                return -1;
+        }
+        return data_update(tree, key, data);
+}
+
+/*
+插入或更新
+键值已存在就原地覆盖数据，不存在就插入
+数据可以为0，不会被当作删除，多值模式下替换整个值列表，数据不能小于0，值日志模式下不能使用
+返回--------------------------成功返回0
+*/
+int bplus_tree_upsert(struct bplus_tree *tree, key_t key, long data)
+{
+        if (((tree->flags & BPLUS_TREE_MULTI) && data < 0) || (tree->flags & BPLUS_TREE_VLOG)) {
+                return -1;
+        }
+
+        int ret = bplus_tree_insert(tree, key, data, 1);
+        if (ret == 0) {
+                count_path_fix(tree, key);
+        }
+        return ret;
+}
+
+/*
+多值模式下向键值的值列表追加一个值，值列表有序且不重复
+键值不存在时插入，只有一个值时直接保存在叶子节点，第二个值开始使用溢出页
+long value--------------------值，不能小于0
+返回--------------------------成功返回0，值已存在、值小于0或者不是多值模式返回-1
+*/
+int bplus_tree_multi_add(struct bplus_tree *tree, key_t key, long value)
+{
+        if (!(tree->flags & BPLUS_TREE_MULTI) || value < 0) {
+                return -1;
+        }
+
+        long data = bplus_tree_search(tree, key);
+        /*新的键值*/
+        if (data == -1) {
+                int ret = bplus_tree_insert(tree, key, value, 0);
+                if (ret == 0) {
+                        count_path_fix(tree, key);
+                }
+                return ret;
+        }
+
+        /*第二个值，建立值列表*/
+        if (!is_posting(data)) {
+                long values[2];
+                if (data == value) {
+                        return -1;
+                }
+                values[0] = data < value ? data : value;
+                values[1] = data < value ? value : data;
+                off_t head = posting_store(tree, INVALID_OFFSET, values, 2, NULL, 0);
+                return data_update(tree, key, posting_encode(head));
+        }
+
+        return posting_add(tree, posting_decode(data), value);
+}
+
+/*
+多值模式下从键值的值列表删除一个值
+只剩一个值时重新保存在叶子节点，删除最后一个值时删除键值
+返回--------------------------成功返回0，值不存在返回-1
+*/
+int bplus_tree_multi_remove(struct bplus_tree *tree, key_t key, long value)
+{
+        if (!(tree->flags & BPLUS_TREE_MULTI) || value < 0) {
+                return -1;
+        }
+
+        long data = bplus_tree_search(tree, key);
+        if (!is_posting(data)) {
+                if (data != value) {
+                        return -1;
+                }
+                int ret = bplus_tree_delete(tree, key);
+                if (ret == 0) {
+                        count_path_fix(tree, key);
+                }
+                return ret;
+        }
+
+        long *values;
+        off_t *pages;
+        int npages;
+        off_t head = posting_decode(data);
+        long n = posting_load(tree, head, &values, &pages, &npages);
+        long i;
+        for (i = 0; i < n && values[i] < value; i++) {
+                continue;
+        }
+
+        int ret = -1;
+        if (i < n && values[i] == value) {
+                memmove(&values[i], &values[i + 1], (n - i - 1) * sizeof(long));
+                if (n - 1 == 1) {
+                        /*释放溢出页，剩下的值保存在叶子节点*/
+                        ret = data_update(tree, key, values[0]);
+                } else {
+                        posting_store(tree, head, values, n - 1, pages, npages);
+                        ret = 0;
+                }
+        }
+        free(values);
+        free(pages);
+        return ret;
+}
+
+/*
+多值模式下读取键值的全部值，按升序返回
+long *values------------------返回的值
+long max----------------------最多返回的个数
+返回--------------------------键值的值的总数，可能大于max，键值不存在返回0
+*/
+long bplus_tree_multi_get(struct bplus_tree *tree, key_t key, long *values, long max)
+{
+        struct posting_page *page = (struct posting_page *) tree->post_buf;
+        long data = bplus_tree_search(tree, key);
+        long n = 0, total;
+
+        if (data == -1) {
+                return 0;
+        }
+        if (!is_posting(data) || !(tree->flags & BPLUS_TREE_MULTI)) {
+                if (max > 0) {
+                        values[0] = data;
+                }
+                return 1;
+        }
+
+        /*逐页解码，不需要一次读出整个列表*/
+        off_t offset = posting_decode(data);
+        posting_read(tree, offset, page);
+        total = page->total;
+        while (n < max) {
+                unsigned char *p = posting_bytes(page);
+                long v = page->first;
+                int i;
+                values[n++] = v;
+                for (i = 1; i < page->count && n < max; i++) {
+                        unsigned long delta;
+                        p += varint_get(p, &delta);
+                        v += delta;
+                        values[n++] = v;
+                }
+                if (page->next == INVALID_OFFSET) {
+                        break;
+                }
+                posting_read(tree, page->next, page);
+        }
+        return total;
+}
+
+/*
+值日志模式下叶子节点中数据的编码，都不小于0
+VLOG_FLAG为0：值直接保存在叶子节点，第56到58位为长度，低7个字节为值
+VLOG_FLAG为1：值保存在值日志，低VLOG_LEN_SHIFT位为记录在值日志中的偏移量，之后为值的长度
+*/
+#define VLOG_FLAG (1L << 62)
+#define VLOG_LEN_SHIFT 36
+#define VLOG_INLINE_SHIFT 56
+#define VLOG_INLINE_MAX 7
+#define VLOG_MAX_VALUE ((1L << 26) - 1)
+#define is_vlog(data) ((data) >= 0 && ((data) & VLOG_FLAG))
+#define vlog_encode(offset, len) (VLOG_FLAG | ((long) (len) << VLOG_LEN_SHIFT) | (long) (offset))
+#define vlog_offset(data) ((off_t) ((data) & ((1L << VLOG_LEN_SHIFT) - 1)))
+#define vlog_len(data) ((long) (((data) >> VLOG_LEN_SHIFT) & VLOG_MAX_VALUE))
+
+/*值日志中的记录按8字节对齐*/
+#define vlog_align(n) (((n) + 7) & ~7L)
+
+/*
+把短值编码到叶子节点的数据中
+*/
+static long vlog_inline_encode(const unsigned char *value, long len)
+{
+        long data = len << VLOG_INLINE_SHIFT;
+        long i;
+        for (i = 0; i < len; i++) {
+                data |= (long) value[i] << (8 * i);
+        }
+        return data;
+}
+
+/*
+从叶子节点的数据中解码短值
+返回--------------------------值的长度
+*/
+static long vlog_inline_decode(long data, unsigned char *buf, long size)
+{
+        long len = (data >> VLOG_INLINE_SHIFT) & 0x7, i;
+        for (i = 0; i < len && i < size; i++) {
+                buf[i] = (data >> (8 * i)) & 0xff;
+        }
+        return len;
+}
+
+/*
+解除值日志的内存映射，值日志被替换后原来的映射失效
+*/
+static void vlog_unmap(struct bplus_tree *tree)
+{
+        if (tree->vlog_map != NULL) {
+                munmap(tree->vlog_map, tree->vlog_mapped);
+                tree->vlog_map = NULL;
+                tree->vlog_mapped = 0;
+        }
+}
+
+/*
+值日志模式下插入或替换键值的值
+不超过VLOG_INLINE_MAX字节的值直接保存在叶子节点，更长的值追加到值日志，叶子节点保存偏移量和长度
+被替换的旧值留在值日志中，由bplus_tree_vlog_gc回收
+返回--------------------------成功返回0，值太长或者不是值日志模式返回-1
+*/
+int bplus_tree_put_value(struct bplus_tree *tree, key_t key, const void *value, long len)
+{
+        long data;
+
+        if (!(tree->flags & BPLUS_TREE_VLOG) || len < 0 || len > VLOG_MAX_VALUE) {
+                return -1;
+        }
+
+        if (len <= VLOG_INLINE_MAX) {
+                data = vlog_inline_encode(value, len);
+        } else {
+                /*记录头和值一次写入*/
+                struct vlog_record rec;
+                struct iovec iov[2];
+                rec.key = key;
+                rec.len = len;
+                iov[0].iov_base = &rec;
+                iov[0].iov_len = sizeof(rec);
+                iov[1].iov_base = (void *) value;
+                iov[1].iov_len = len;
+                if (tree->vlog_size + (off_t) sizeof(rec) + len >= (1L << VLOG_LEN_SHIFT)) {
+                        return -1;
+                }
+                if (pwritev(tree->vlog_fd, iov, 2, tree->vlog_size) != (ssize_t) (sizeof(rec) + len)) {
+                        return -1;
+                }
+                data = vlog_encode(tree->vlog_size, len);
+                tree->vlog_size += vlog_align(sizeof(rec) + len);
+        }
+
+        int ret = bplus_tree_insert(tree, key, data, 1);
+        if (ret == 0) {
+                count_path_fix(tree, key);
+        }
+        return ret;
+}
+
+/*
+值日志模式下读取键值的值，直接从值日志读入调用者的缓冲区
+void *buf---------------------缓冲区
+long size---------------------缓冲区大小，值更长时只读取前size字节
+返回--------------------------值的长度，键值不存在返回-1
+*/
+long bplus_tree_get_value(struct bplus_tree *tree, key_t key, void *buf, long size)
+{
+        long data = bplus_tree_search(tree, key);
+
+        if (data == -1) {
+                return -1;
+        }
+        if (!is_vlog(data)) {
+                return vlog_inline_decode(data, buf, size);
+        }
+
+        long len = vlog_len(data);
+        long n = len < size ? len : size;
+        if (n > 0 && pread(tree->vlog_fd, buf, n, vlog_offset(data) + sizeof(struct vlog_record)) != n) {
+                return -1;
+        }
+        return len;
+}
+
+/*
+值日志模式下通过内存映射读取键值的值，不复制
+值日志增长后重新映射，返回的地址在下一次调用、写入或者垃圾回收之前有效
+短值没有映射，复制到B+树信息结构体中的缓冲区
+long *len---------------------返回值的长度
+返回--------------------------值的地址，键值不存在返回NULL
+*/
+const void *bplus_tree_map_value(struct bplus_tree *tree, key_t key, long *len)
+{
+        long data = bplus_tree_search(tree, key);
+
+        if (data == -1) {
+                return NULL;
+        }
+        if (!is_vlog(data)) {
+                *len = vlog_inline_decode(data, tree->vlog_inline, sizeof(tree->vlog_inline));
+                return tree->vlog_inline;
+        }
+
+        off_t offset = vlog_offset(data) + sizeof(struct vlog_record);
+        *len = vlog_len(data);
+        if (offset + *len > (off_t) tree->vlog_mapped) {
+                vlog_unmap(tree);
+                void *map = mmap(NULL, tree->vlog_size, PROT_READ, MAP_SHARED, tree->vlog_fd, 0);
+                if (map == MAP_FAILED) {
+                        return NULL;
+                }
+                tree->vlog_map = map;
+                tree->vlog_mapped = tree->vlog_size;
+        }
+        return tree->vlog_map + offset;
+}
+
+/*
+把值日志中每条记录的键值指向该记录，垃圾回收的最后一步
+新的值日志中每个键值只有一条记录，重复执行结果相同
+*/
+static void vlog_remap(struct bplus_tree *tree)
+{
+        struct vlog_record rec;
+        off_t in = 0;
+
+        while (in < tree->vlog_size) {
+                int len = pread(tree->vlog_fd, &rec, sizeof(rec), in);
+                assert(len == sizeof(rec));
+                int ret = data_update(tree, rec.key, vlog_encode(in, rec.len));
+                assert(ret == 0);
+                in += vlog_align(sizeof(rec) + rec.len);
+        }
+        int ret = fsync(tree->fd);
+        assert(ret == 0);
+}
+
+/*
+恢复上次中断的垃圾回收
+<vlog>.gc还存在：新的值日志没有替换<vlog>，叶子节点没有修改，<vlog>仍是旧的值日志，删除.gc和.old
+<vlog>.gc不存在而<vlog>.old存在：替换已完成，叶子节点可能没有修改完，重新修改后删除.old
+*/
+static void vlog_recover(struct bplus_tree *tree)
+{
+        char name[1024 + 8], old[1024 + 8];
+
+        snprintf(name, sizeof(name), "%s.gc", tree->vlog_name);
+        snprintf(old, sizeof(old), "%s.old", tree->vlog_name);
+        if (access(name, F_OK) == 0) {
+                unlink(name);
+                unlink(old);
+        } else if (access(old, F_OK) == 0) {
+                vlog_remap(tree);
+                unlink(old);
+        }
+}
+
+/*
+把文件所在目录写入磁盘，rename之后调用，保证替换在断电后仍然有效
+*/
+static int dir_sync(const char *filename)
+{
+        char dir[1024];
+        const char *slash = strrchr(filename, '/');
+
+        if (slash == NULL) {
+                strcpy(dir, ".");
+        } else if (slash == filename) {
+                strcpy(dir, "/");
+        } else {
+                snprintf(dir, sizeof(dir), "%.*s", (int) (slash - filename), filename);
+        }
+        int fd = open(dir, O_RDONLY);
+        if (fd < 0) {
+                return -1;
+        }
+        int ret = fsync(fd);
+        close(fd);
+        return ret;
+}
+
+/*
+值日志垃圾回收
+顺序读取值日志，叶子节点仍然指向的记录复制到新的值日志，被替换和被删除的值不再复制
+顺序保证任何时候中断都能恢复：
+1. 复制到<vlog>.gc并写入磁盘，叶子节点不变，中断时仍使用旧的值日志，vlog_recover删除.gc
+2. 旧的值日志保留为<vlog>.old，新的值日志替换<vlog>，.gc消失表示替换完成，目录写入磁盘
+3. 修改叶子节点中的偏移量，完成后删除<vlog>.old，中断时由下次打开的vlog_recover重新修改
+返回--------------------------回收的字节数，失败返回-1
+*/
+long bplus_tree_vlog_gc(struct bplus_tree *tree)
+{
+        char name[1024 + 8], old[1024 + 8];
+        struct vlog_record rec;
+        off_t in = 0, out = 0;
+        char *buf = NULL;
+        long cap = 0;
+        int ok = 1;
+
+        if (!(tree->flags & BPLUS_TREE_VLOG)) {
+                return -1;
+        }
+
+        snprintf(name, sizeof(name), "%s.gc", tree->vlog_name);
+        snprintf(old, sizeof(old), "%s.old", tree->vlog_name);
+        int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+                return -1;
+        }
+
+        while (ok && in < tree->vlog_size) {
+                if (pread(tree->vlog_fd, &rec, sizeof(rec), in) != sizeof(rec)) {
+                        ok = 0;
+                        break;
+                }
+                long size = vlog_align(sizeof(rec) + rec.len);
+                long data = bplus_tree_search(tree, rec.key);
+
+                /*叶子节点仍然指向该记录，复制到新的值日志*/
+                if (is_vlog(data) && vlog_offset(data) == in) {
+                        ssize_t len = sizeof(rec) + rec.len;
+                        if (size > cap) {
+                                cap = size;
+                                buf = realloc(buf, cap);
+                                assert(buf != NULL);
+                        }
+                        if (pread(tree->vlog_fd, buf, len, in) != len || pwrite(fd, buf, len, out) != len) {
+                                ok = 0;
+                                break;
+                        }
+                        out += size;
+                }
+                in += size;
+        }
+        free(buf);
+
+        /*新的值日志写入磁盘后再替换，旧的值日志保留到叶子节点修改完成*/
+        unlink(old);
+        if (!ok || fsync(fd) != 0 || link(tree->vlog_name, old) != 0) {
+                close(fd);
+                unlink(name);
+                return -1;
+        }
+        if (rename(name, tree->vlog_name) != 0) {
+                unlink(old);
+                close(fd);
+                unlink(name);
+                return -1;
+        }
+        dir_sync(tree->vlog_name);
+        vlog_unmap(tree);
+        close(tree->vlog_fd);
+        tree->vlog_fd = fd;
+        tree->vlog_size = out;
+
+        vlog_remap(tree);
+        unlink(old);
+        return in - out;
+}
+
+/*
+设置延迟删除
+int threshold-----------------小于0：删除后立即合并(默认)
+                              大于等于0：叶子节点删除后数据不少于threshold时只删除不合并，0表示允许删空
+                              欠满的叶子节点加入队列，由bplus_tree_maintain整理
+*/
+void bplus_tree_lazy_delete(struct bplus_tree *tree, int threshold)
+{
+        tree->lazy_threshold = threshold;
+}
+
+/*
+整理延迟删除留下的欠满叶子节点，可在空闲时由后台调用
+布隆过滤器加入的键值超过容量2倍时也在这里重建
+int max-----------------------最多整理的叶子节点个数，小于等于0时全部整理
+返回--------------------------队列中剩余的叶子节点个数
+*/
+int bplus_tree_maintain(struct bplus_tree *tree, int max)
+{
+        int done = 0, left = 0;
+        struct list_head *pos;
+
+        while (!list_empty(&tree->lazy_leaves) && (max <= 0 || done < max)) {
+                struct lazy_leaf *lazy = list_first_entry(&tree->lazy_leaves, struct lazy_leaf, link);
+                off_t offset = lazy->offset;
+                list_del(&lazy->link);
+                free(lazy);
+
+                leaf_rebalance(tree, node_fetch(tree, offset));
+                done++;
+        }
+
+        if (tree->bloom != NULL && tree->bloom_keys >= 2 * tree->bloom_capacity) {
+                bplus_tree_bloom_build(tree, 0, tree->bloom_bits / tree->bloom_capacity);
+        }
+
+        list_for_each(pos, &tree->lazy_leaves) {
+                left++;
+        }
+        return left;
+}
+
+/*
+释放lo到hi之间(包含两端)的键值的值列表
+*/
+static void posting_drop_range(struct bplus_tree *tree, key_t lo, key_t hi)
+{
+        off_t path[MAX_DEPTH];
+        int depth = path_search(tree, lo, path);
+        struct bplus_node *node = node_seek(tree, path[depth - 1]);
+
+        while (node != NULL) {
+                int i;
+                for (i = 0; i < node->children; i++) {
+                        if (key(node)[i] > hi) {
+                                return;
+                        }
+                        if (key(node)[i] >= lo) {
+                                posting_drop(tree, data(node)[i]);
+                        }
+                }
+                node = node_seek(tree, node->next);
+        }
+}
+
+/*
+整块释放一棵子树，只读取非叶子节点，叶子节点直接释放不读取
+off_t offset------------------子树根节点的偏移量
+int height--------------------子树高度，叶子节点为1
+*/
+static void subtree_free(struct bplus_tree *tree, off_t offset, int height)
+{
+        if (height > 1) {
+                struct bplus_node *node = node_fetch(tree, offset);
+                int i, n = node->children;
+                /*递归时不占用缓存，先复制孩子的偏移量*/
+                off_t *subs = malloc(n * sizeof(off_t));
+                assert(subs != NULL);
+                memcpy(subs, sub(node), n * sizeof(off_t));
+                cache_defer(tree, node);
+                for (i = 0; i < n; i++) {
+                        subtree_free(tree, subs[i], height - 1);
+                }
+                free(subs);
+        }
+        block_free(tree, offset);
+}
+
+/*
+修复范围删除后只剩一个孩子的非叶子节点
+根节点：唯一的孩子成为新的根节点
+非根节点：同一父节点下的兄弟未满就合并过去，兄弟已满就借一个孩子过来
+*/
+static void non_leaf_fix(struct bplus_tree *tree, struct bplus_node *node)
+{
+        assert(node->children == 1);
+
+        /*根节点只剩一个孩子，降低一层*/
+        if (node->parent == INVALID_OFFSET) {
+                struct bplus_node *root = node_fetch(tree, sub(node)[0]);
+                root->parent = INVALID_OFFSET;
+                tree->root = root->self;
+                tree->level--;
+                node_delete(tree, node, NULL, NULL);
+                node_flush(tree, root);
+                return;
+        }
+
+        struct bplus_node *parent = node_fetch(tree, node->parent);
+        int c = parent_sub_index(parent, node->self);
+
+        /*有左兄弟*/
+        if (c > 0) {
+                struct bplus_node *left = node_fetch(tree, sub(parent)[c - 1]);
+                if (left->children < _max_order) {
+                        /*唯一的孩子并入左兄弟，父节点的键值下移*/
+                        key(left)[left->children - 1] = key(parent)[c - 1];
+                        sub(left)[left->children] = sub(node)[0];
+                        count_move(tree, left, left->children, node, 0, 1);
+                        sub_node_flush(tree, left, sub(left)[left->children]);
+                        left->children++;
+                        count_sync(tree, parent, left);
+                        non_leaf_simple_remove(tree, parent, c - 1);
+                        node_delete(tree, node, left, node_fetch(tree, node->next));
+                        node_flush(tree, parent);
+                } else {
+                        /*从左兄弟借一个孩子*/
+                        non_leaf_shift_from_left(tree, node, left, parent, c - 1, 0);
+                        node->children++;
+                        count_sync(tree, parent, node);
+                        count_sync(tree, parent, left);
+                        node_flush(tree, node);
+                        node_flush(tree, left);
+                        node_flush(tree, parent);
+                }
+        /*只有右兄弟*/
+        } else {
+                struct bplus_node *right = node_fetch(tree, sub(parent)[1]);
+                if (right->children < _max_order) {
+                        /*唯一的孩子并入右兄弟的最前面，父节点的键值下移*/
+                        memmove(&key(right)[1], &key(right)[0], (right->children - 1) * sizeof(key_t));
+                        memmove(&sub(right)[1], &sub(right)[0], right->children * sizeof(off_t));
+                        count_move(tree, right, 1, right, 0, right->children);
+                        key(right)[0] = key(parent)[0];
+                        sub(right)[0] = sub(node)[0];
+                        count_move(tree, right, 0, node, 0, 1);
+                        sub_node_flush(tree, right, sub(right)[0]);
+                        right->children++;
+                        count_sync(tree, parent, right);
+
+                        /*从父节点删除第一个分支和键值*/
+                        memmove(&key(parent)[0], &key(parent)[1], (parent->children - 2) * sizeof(key_t));
+                        memmove(&sub(parent)[0], &sub(parent)[1], (parent->children - 1) * sizeof(off_t));
+                        count_move(tree, parent, 0, parent, 1, parent->children - 1);
+                        parent->children--;
+                        node_delete(tree, node, node_fetch(tree, node->prev), right);
+                        node_flush(tree, parent);
+                } else {
+                        /*从右兄弟借一个孩子*/
+                        non_leaf_shift_from_right(tree, node, right, parent, 0);
+                        count_sync(tree, parent, node);
+                        count_sync(tree, parent, right);
+                        node_flush(tree, node);
+                        node_flush(tree, right);
+                        node_flush(tree, parent);
+                }
+        }
+}
+
+/*
+范围删除后的修复
+自顶向下修复两条边界路径上只剩一个孩子的非叶子节点，每次修复后重新查找路径
+最后处理两个边界叶子节点：延迟删除模式下欠满但不低于阈值的加入待整理队列，否则立即合并或借数据
+*/
+static void range_repair(struct bplus_tree *tree, key_t lo, key_t hi)
+{
+        off_t path[2][MAX_DEPTH];
+        int depth, d, k, fixed;
+
+        do {
+                fixed = 0;
+                if (tree->root == INVALID_OFFSET) {
+                        return;
+                }
+                depth = path_search(tree, lo, path[0]);
+                path_search(tree, hi, path[1]);
+                for (d = 0; d < depth - 1 && !fixed; d++) {
+                        for (k = 0; k < 2 && !fixed; k++) {
+                                struct bplus_node *node = node_fetch(tree, path[k][d]);
+                                if (node->children >= 2) {
+                                        cache_defer(tree, node);
+                                } else {
+                                        non_leaf_fix(tree, node);
+                                        fixed = 1;
+                                }
+                        }
+                }
+        } while (fixed);
+
+        for (k = 0; k < 2; k++) {
+                if (tree->root == INVALID_OFFSET) {
+                        return;
+                }
+                depth = path_search(tree, k == 0 ? lo : hi, path[0]);
+                struct bplus_node *leaf = node_fetch(tree, path[0][depth - 1]);
+                if (leaf->children >= (_max_entries + 1) / 2) {
+                        cache_defer(tree, leaf);
+                } else if (tree->lazy_threshold >= 0 && leaf->parent != INVALID_OFFSET &&
+                           leaf->children >= tree->lazy_threshold) {
+                        struct lazy_leaf *lazy = malloc(sizeof(*lazy));
+                        assert(lazy != NULL);
+                        lazy->offset = leaf->self;
+                        list_add_tail(&lazy->link, &tree->lazy_leaves);
+                        cache_defer(tree, leaf);
+                } else {
+                        leaf_rebalance(tree, leaf);
+                }
+        }
+}
+
+/*
+范围删除，删除key1到key2之间(包含两端)的全部键值
+两个边界叶子节点只删除范围内的数据，中间被完全覆盖的叶子节点和子树整块释放，不逐个删除
+每一层的两个边界节点直接相连，跳过被释放的节点，最后统一修复
+返回--------------------------成功返回0，空树返回-1
+*/
+int bplus_tree_delete_range(struct bplus_tree *tree, key_t key1, key_t key2)
+{
+        int d, i, a, b, depth;
+        off_t path_lo[MAX_DEPTH], path_hi[MAX_DEPTH];
+        key_t lo = key1 <= key2 ? key1 : key2;
+        key_t hi = lo == key1 ? key2 : key1;
+
+        if (tree->root == INVALID_OFFSET) {
+                return -1;
+        }
+
+        if (tree->hot != NULL) {
+                hot_invalidate_range(tree, lo, hi);
+        }
+        /*范围删除释放的叶子节点较多，学习索引在下一次查找时重建*/
+        if (tree->learned != NULL) {
+                tree->learned->stale = 1;
+        }
+
+        /*多值模式下先释放范围内的值列表，被释放的叶子节点不会再读取*/
+        if (tree->flags & BPLUS_TREE_MULTI) {
+                posting_drop_range(tree, lo, hi);
+        }
+
+        /*两个边界的路径，层数相同*/
+        depth = path_search(tree, lo, path_lo);
+        path_search(tree, hi, path_hi);
+
+        for (d = 0; d < depth; d++) {
+                struct bplus_node *x = node_fetch(tree, path_lo[d]);
+
+                /*两个边界在同一个节点*/
+                if (path_lo[d] == path_hi[d]) {
+                        if (is_leaf(x)) {
+                                /*删除[lo, hi]内的数据*/
+                                a = key_binary_search(tree, x, lo);
+                                a = a >= 0 ? a : -a - 1;
+                                b = key_binary_search(tree, x, hi);
+                                b = b >= 0 ? b + 1 : -b - 1;
+                                memmove(&key(x)[a], &key(x)[b], (x->children - b) * sizeof(key_t));
+                                memmove(&data(x)[a], &data(x)[b], (x->children - b) * sizeof(long));
+                                x->children -= b - a;
+                        } else {
+                                /*释放两条路径之间的分支*/
+                                a = parent_sub_index(x, path_lo[d + 1]);
+                                b = parent_sub_index(x, path_hi[d + 1]);
+                                for (i = a + 1; i < b; i++) {
+                                        subtree_free(tree, sub(x)[i], depth - d - 1);
+                                }
+                                if (b > a + 1) {
+                                        memmove(&key(x)[a], &key(x)[b - 1], (x->children - b) * sizeof(key_t));
+                                        memmove(&sub(x)[a + 1], &sub(x)[b], (x->children - b) * sizeof(off_t));
+                                        count_move(tree, x, a + 1, x, b, x->children - b);
+                                        x->children -= b - a - 1;
+                                }
+                        }
+                        node_flush(tree, x);
+                /*两条路径已分开，x为左边界节点，y为右边界节点*/
+                } else {
+                        struct bplus_node *y = node_fetch(tree, path_hi[d]);
+
+                        /*同一层的两个边界节点直接相连，跳过中间被释放的节点*/
+                        x->next = y->self;
+                        y->prev = x->self;
+
+                        if (is_leaf(x)) {
+                                /*左边界删除大于等于lo的数据，右边界删除小于等于hi的数据*/
+                                a = key_binary_search(tree, x, lo);
+                                x->children = a >= 0 ? a : -a - 1;
+                                b = key_binary_search(tree, y, hi);
+                                b = b >= 0 ? b + 1 : -b - 1;
+                                memmove(&key(y)[0], &key(y)[b], (y->children - b) * sizeof(key_t));
+                                memmove(&data(y)[0], &data(y)[b], (y->children - b) * sizeof(long));
+                                y->children -= b;
+                        } else {
+                                /*左边界释放路径右边的分支，右边界释放路径左边的分支*/
+                                a = parent_sub_index(x, path_lo[d + 1]);
+                                for (i = a + 1; i < x->children; i++) {
+                                        subtree_free(tree, sub(x)[i], depth - d - 1);
+                                }
+                                x->children = a + 1;
+
+                                b = parent_sub_index(y, path_hi[d + 1]);
+                                for (i = 0; i < b; i++) {
+                                        subtree_free(tree, sub(y)[i], depth - d - 1);
+                                }
+                                memmove(&key(y)[0], &key(y)[b], (y->children - 1 - b) * sizeof(key_t));
+                                memmove(&sub(y)[0], &sub(y)[b], (y->children - b) * sizeof(off_t));
+                                count_move(tree, y, 0, y, b, y->children - b);
+                                y->children -= b;
+                        }
+                        node_flush(tree, x);
+                        node_flush(tree, y);
+                }
+        }
+
+        /*两条边界路径上的分支计数*/
+        count_path_fix(tree, lo);
+        count_path_fix(tree, hi);
+
+        range_repair(tree, lo, hi);
+        return 0;
+}
+
+/*
+完整地读写一段数据，大的读写一次可能只完成一部分
+int out-----------------------1为写，0为读
+返回--------------------------成功返回0，出错或读到文件末尾返回-1
+*/
+static int bulk_io(int fd, void *buf, size_t len, off_t offset, int out)
+{
+        char *p = buf;
+        while (len > 0) {
+                ssize_t n = out ? pwrite(fd, p, len, offset) : pread(fd, p, len, offset);
+                if (n <= 0) {
+                        return -1;
+                }
+                p += n;
+                len -= n;
+                offset += n;
+        }
+        return 0;
+}
+
+/*键值的第shift位开始的8位，符号位取反，负数排在前面*/
+#define bulk_digit(key, shift) ((((unsigned int) (key) ^ 0x80000000u) >> (shift)) & 0xff)
+
+/*
+顺串按键值排序，低位优先的基数排序，每次8位，相同键值保持输入的顺序
+所有键值这8位都相同时跳过这一次
+struct bplus_record *tmp------和顺串同样大小的辅助空间
+*/
+static void bulk_radix_sort(struct bplus_record *run, struct bplus_record *tmp, long n)
+{
+        struct bplus_record *src = run, *dst = tmp, *t;
+        long count[256], i, pos;
+        int shift, d;
+
+        for (shift = 0; shift < 32; shift += 8) {
+                memset(count, 0, sizeof(count));
+                for (i = 0; i < n; i++) {
+                        count[bulk_digit(src[i].key, shift)]++;
+                }
+                if (n == 0 || count[bulk_digit(src[0].key, shift)] == n) {
+                        continue;
+                }
+                for (d = 0, pos = 0; d < 256; d++) {
+                        long c = count[d];
+                        count[d] = pos;
+                        pos += c;
+                }
+                for (i = 0; i < n; i++) {
+                        dst[count[bulk_digit(src[i].key, shift)]++] = src[i];
+                }
+                t = src;
+                src = dst;
+                dst = t;
+        }
+        if (src != run) {
+                memcpy(run, src, n * sizeof(*run));
+        }
+}
+
+/*
+排序线程，每次取一个顺串，读入、排序后写到临时文件的相同位置，直到没有顺串
+*/
+static void *bulk_sort_worker(void *arg)
+{
+        struct bulk_sort *job = arg;
+        struct bplus_record *run = malloc(job->run_len * sizeof(*run));
+        struct bplus_record *tmp = malloc(job->run_len * sizeof(*tmp));
+        int error = run == NULL || tmp == NULL;
+
+        while (!error) {
+                pthread_mutex_lock(&job->lock);
+                long r = job->error ? job->runs : job->next++;
+                pthread_mutex_unlock(&job->lock);
+                if (r >= job->runs) {
+                        break;
+                }
+
+                long start = r * job->run_len;
+                long n = job->records - start < job->run_len ? job->records - start : job->run_len;
+                off_t offset = start * sizeof(*run);
+                if (bulk_io(job->in_fd, run, n * sizeof(*run), offset, 0) < 0) {
+                        error = 1;
+                        break;
+                }
+                bulk_radix_sort(run, tmp, n);
+                if (bulk_io(job->tmp_fd, run, n * sizeof(*run), offset, 1) < 0) {
+                        error = 1;
+                }
+        }
+
+        if (error) {
+                pthread_mutex_lock(&job->lock);
+                job->error = 1;
+                pthread_mutex_unlock(&job->lock);
+        }
+        free(run);
+        free(tmp);
+        return NULL;
+}
+
+/*
+读取顺串的下一段到读缓冲
+返回--------------------------读取的记录个数，顺串读完返回0，出错返回-1
+*/
+static int bulk_run_fill(struct bulk_run *run, int fd, int size)
+{
+        long n = (run->end - run->pos) / sizeof(struct bplus_record);
+        if (n > size) {
+                n = size;
+        }
+        if (n == 0) {
                 return 0;
-		/*右节点没有父节点*/
-        } else if (r_ch->parent == INVALID_OFFSET) {
-				/*node_fetch(tree, l_ch->parent):从.index文件获取*/
-                return non_leaf_insert(tree, node_fetch(tree, l_ch->parent), l_ch, r_ch, key);
-        /*左节点没有父节点*/
-		} else {
-				/*node_fetch(tree, r_ch->parent):从.index文件获取*/
-                return non_leaf_insert(tree, node_fetch(tree, r_ch->parent), l_ch, r_ch, key);
+        }
+        if (bulk_io(fd, run->buf, n * sizeof(struct bplus_record), run->pos, 0) < 0) {
+                return -1;
+        }
+        run->pos += n * sizeof(struct bplus_record);
+        run->n = n;
+        run->i = 0;
+        return n;
+}
+
+/*
+归并堆的比较，键值相同时前面的顺串优先，合并结果保持输入的顺序
+*/
+static inline int bulk_less(struct bulk_run *runs, int a, int b)
+{
+        key_t x = runs[a].buf[runs[a].i].key, y = runs[b].buf[runs[b].i].key;
+        return x < y || (x == y && a < b);
+}
+
+/*
+归并堆的第k个元素向下调整
+*/
+static void bulk_sift(struct bulk_run *runs, int *heap, int m, int k)
+{
+        for (;;) {
+                int c = 2 * k + 1;
+                if (c >= m) {
+                        break;
+                }
+                if (c + 1 < m && bulk_less(runs, heap[c + 1], heap[c])) {
+                        c++;
+                }
+                if (!bulk_less(runs, heap[c], heap[k])) {
+                        break;
+                }
+                int t = heap[c];
+                heap[c] = heap[k];
+                heap[k] = t;
+                k = c;
+        }
+}
+
+/*批量建立时第level层正在填充的节点*/
+#define bulk_node(b, level) ((struct bplus_node *) ((b)->nodes + (long) _block_size * (level)))
+
+/*
+写入批量建立的节点，区块可能来自空闲区块链表，存在快照时和节点一样先保存旧内容
+*/
+static inline void bulk_write(struct bplus_tree *tree, struct bplus_node *node)
+{
+        if (tree->snap_buf != NULL) {
+                snapshot_preserve(tree, node->self);
+        }
+        int len = pwrite(tree->fd, node, _block_size, node->self);
+        assert(len == _block_size);
+}
+
+/*
+第level层正在填充的节点已满，写入该节点，开始它的右兄弟
+右兄弟加入父节点，key为右兄弟下的第一个键值，作为父节点中的分隔键值
+当前层只有一个节点时新建父节点作为根节点，父节点已满时先对父节点做同样的处理
+*/
+static void bulk_next(struct bplus_tree *tree, struct bulk_builder *b, int level, key_t key)
+{
+        struct bplus_node *node = bulk_node(b, level);
+        struct bplus_node *parent = bulk_node(b, level + 1);
+
+        assert(level + 1 < MAX_DEPTH);
+        if (level + 1 == b->height) {
+                parent->self = block_new(tree);
+                parent->parent = INVALID_OFFSET;
+                parent->prev = INVALID_OFFSET;
+                parent->next = INVALID_OFFSET;
+                parent->type = BPLUS_TREE_NON_LEAF;
+                parent->children = 1;
+                sub(parent)[0] = node->self;
+                node->parent = parent->self;
+                b->counts[level + 1] = 0;
+                b->height++;
+        }
+
+        /*当前节点已完成，键值个数计入父节点*/
+        if (tree->flags & BPLUS_TREE_COUNTS) {
+                count(parent)[parent->children - 1] = b->counts[level];
+        }
+        b->counts[level + 1] += b->counts[level];
+
+        if (parent->children == _max_order) {
+                bulk_next(tree, b, level + 1, key);
+        }
+
+        /*右兄弟加入父节点，写入当前节点*/
+        off_t offset = block_new(tree);
+        if (parent->children > 0) {
+                key(parent)[parent->children - 1] = key;
+        }
+        sub(parent)[parent->children++] = offset;
+        node->next = offset;
+        bulk_write(tree, node);
+
+        /*缓冲区继续作为右兄弟填充*/
+        node->prev = node->self;
+        node->self = offset;
+        node->next = INVALID_OFFSET;
+        node->parent = parent->self;
+        node->children = 0;
+        b->counts[level] = 0;
+}
+
+/*
+批量建立时追加一个键值，键值必须递增
+*/
+static void bulk_add(struct bplus_tree *tree, struct bulk_builder *b, key_t key, long data)
+{
+        struct bplus_node *leaf = bulk_node(b, 0);
+
+        if (b->height == 0) {
+                leaf->self = block_new(tree);
+                leaf->parent = INVALID_OFFSET;
+                leaf->prev = INVALID_OFFSET;
+                leaf->next = INVALID_OFFSET;
+                leaf->type = BPLUS_TREE_LEAF;
+                leaf->children = 0;
+                b->counts[0] = 0;
+                b->height = 1;
+        } else if (leaf->children == _max_entries) {
+                bulk_next(tree, b, 0, key);
+        }
+
+        key(leaf)[leaf->children] = key;
+        data(leaf)[leaf->children] = data;
+        leaf->children++;
+        b->counts[0]++;
+}
+
+/*
+批量建立结束，自底向上写入每一层最后的节点，最上层的节点为根节点
+*/
+static void bulk_finish(struct bplus_tree *tree, struct bulk_builder *b)
+{
+        int level;
+        for (level = 0; level < b->height; level++) {
+                struct bplus_node *node = bulk_node(b, level);
+                if (level + 1 < b->height) {
+                        struct bplus_node *parent = bulk_node(b, level + 1);
+                        if (tree->flags & BPLUS_TREE_COUNTS) {
+                                count(parent)[parent->children - 1] = b->counts[level];
+                        }
+                        b->counts[level + 1] += b->counts[level];
+                }
+                bulk_write(tree, node);
+        }
+        tree->root = bulk_node(b, b->height - 1)->self;
+        tree->level = b->height;
+}
+
+/*
+从无序的输入文件批量建立B+树，只能用于空树
+1. 多个线程并行排序：输入按memory分成顺串，每个线程读入一个顺串，基数排序后写到临时文件
+2. 多路归并所有顺串，得到有序的键值流
+3. 键值流直接填满叶子节点，每一层只保留一个正在填充的节点，填满就写入，每个区块只写一次
+4. 最右边路径上可能欠满的节点按范围删除的方式修复
+重复的键值保留输入中的第一个，数据为0的记录忽略
+char *input-------------------输入文件，struct bplus_record的数组
+int threads-------------------排序线程个数
+long memory-------------------排序和归并使用的内存字节数
+返回--------------------------插入的键值个数，出错返回-1
+*/
+long bplus_tree_bulk_build(struct bplus_tree *tree, char *input, int threads, long memory)
+{
+        struct bulk_sort job;
+        struct stat st;
+        char name[1040];
+        long i, keys = 0;
+        key_t last = 0;
+        int k, m = 0;
+
+        /*多值模式和值日志模式的数据是编码，不能直接写入*/
+        if (tree->root != INVALID_OFFSET || (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG))) {
+                return -1;
+        }
+
+        job.in_fd = open(input, O_RDONLY);
+        if (job.in_fd < 0) {
+                return -1;
+        }
+        if (fstat(job.in_fd, &st) < 0) {
+                close(job.in_fd);
+                return -1;
+        }
+
+        /*临时文件和.index在同一目录，打开后立即删除，关闭时自动释放，tree->filename以.boot结尾*/
+        snprintf(name, sizeof(name), "%.*s.sort", (int) strlen(tree->filename) - 5, tree->filename);
+        job.tmp_fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (job.tmp_fd < 0) {
+                close(job.in_fd);
+                return -1;
+        }
+        unlink(name);
+
+        /*每个线程排序时需要两倍顺串大小的内存*/
+        threads = threads < 1 ? 1 : threads;
+        job.records = st.st_size / sizeof(struct bplus_record);
+        job.run_len = memory / threads / (2 * sizeof(struct bplus_record));
+        if (job.run_len < BULK_MIN_RUN) {
+                job.run_len = BULK_MIN_RUN;
+        }
+        job.runs = (job.records + job.run_len - 1) / job.run_len;
+        job.next = 0;
+        job.error = 0;
+        pthread_mutex_init(&job.lock, NULL);
+        posix_fadvise(job.in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        if (threads > job.runs) {
+                threads = job.runs;
+        }
+        pthread_t *workers = malloc(threads * sizeof(pthread_t));
+        assert(workers != NULL);
+        /*线程从同一个队列取顺串，创建失败时用已创建的线程，一个都没有时在当前线程排序*/
+        int started;
+        for (started = 0; started < threads; started++) {
+                if (pthread_create(&workers[started], NULL, bulk_sort_worker, &job) != 0) {
+                        break;
+                }
+        }
+        if (started == 0) {
+                bulk_sort_worker(&job);
+        }
+        for (k = 0; k < started; k++) {
+                pthread_join(workers[k], NULL);
+        }
+        free(workers);
+        pthread_mutex_destroy(&job.lock);
+        close(job.in_fd);
+        if (job.error) {
+                close(job.tmp_fd);
+                return -1;
+        }
+
+        /*多路归并，所有顺串的读缓冲平分内存*/
+        long size = memory / (job.runs > 0 ? job.runs : 1) / sizeof(struct bplus_record);
+        size = size < BULK_MIN_READ ? BULK_MIN_READ : size > job.run_len ? job.run_len : size;
+        struct bulk_run *runs = calloc(job.runs > 0 ? job.runs : 1, sizeof(*runs));
+        int *heap = malloc((job.runs > 0 ? job.runs : 1) * sizeof(int));
+        assert(runs != NULL && heap != NULL);
+        posix_fadvise(job.tmp_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        /*读临时文件出错时停止归并，树仍为空，已经写入的区块不再回收*/
+        int ok = 1;
+        for (i = 0; i < job.runs; i++) {
+                runs[i].buf = malloc(size * sizeof(struct bplus_record));
+                assert(runs[i].buf != NULL);
+                runs[i].pos = i * job.run_len * sizeof(struct bplus_record);
+                runs[i].end = (i + 1 < job.runs ? (i + 1) * job.run_len : job.records) * sizeof(struct bplus_record);
+                int n = bulk_run_fill(&runs[i], job.tmp_fd, size);
+                if (n <= 0) {
+                        ok = 0;
+                        m = 0;
+                        break;
+                }
+                heap[m++] = i;
+        }
+        for (k = m / 2 - 1; k >= 0; k--) {
+                bulk_sift(runs, heap, m, k);
+        }
+
+        struct bulk_builder b;
+        memset(&b, 0, sizeof(b));
+        int ret = posix_memalign((void **) &b.nodes, DIRECT_IO_ALIGN, (size_t) _block_size * MAX_DEPTH);
+        assert(ret == 0);
+        memset(b.nodes, 0, (size_t) _block_size * MAX_DEPTH);
+
+        while (m > 0) {
+                struct bulk_run *run = &runs[heap[0]];
+                struct bplus_record rec = run->buf[run->i++];
+                if (run->i == run->n) {
+                        int n = bulk_run_fill(run, job.tmp_fd, size);
+                        if (n < 0) {
+                                ok = 0;
+                                break;
+                        }
+                        if (n == 0) {
+                                heap[0] = heap[--m];
+                        }
+                }
+                bulk_sift(runs, heap, m, 0);
+
+                if (rec.data == 0 || (keys > 0 && rec.key == last)) {
+                        continue;
+                }
+                bulk_add(tree, &b, rec.key, rec.data);
+                if (tree->bloom != NULL) {
+                        bloom_add(tree, rec.key);
+                }
+                last = rec.key;
+                keys++;
+        }
+
+        if (ok && keys > 0) {
+                bulk_finish(tree, &b);
+                range_repair(tree, last, last);
+        }
+        tree->tail = INVALID_OFFSET;
+        if (tree->learned != NULL) {
+                tree->learned->stale = 1;
+        }
+        if (ok && tree->bloom != NULL && tree->bloom_keys >= 2 * tree->bloom_capacity) {
+                bplus_tree_bloom_build(tree, 0, tree->bloom_bits / tree->bloom_capacity);
+        }
+
+        free(b.nodes);
+        for (i = 0; i < job.runs; i++) {
+                free(runs[i].buf);
+        }
+        free(runs);
+        free(heap);
+        close(job.tmp_fd);
+        return ok ? keys : -1;
+}
+
+/*
+键值的排名，即小于(inclusive为1时小于等于)key的键值个数
+从根节点到叶子节点查找一次，累加路径左边分支的计数
+*/
+static long key_rank(struct bplus_tree *tree, key_t key, int inclusive)
+{
+        long rank = 0;
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+                int i = key_binary_search(tree, node, key);
+                if (is_leaf(node)) {
+                        if (i >= 0) {
+                                rank += inclusive ? i + 1 : i;
+                        } else {
+                                rank += -i - 1;
+                        }
+                        break;
+                } else {
+                        int j;
+                        i = i >= 0 ? i + 1 : -i - 1;
+                        for (j = 0; j < i; j++) {
+                                rank += count(node)[j];
+                        }
+                        node = node_seek(tree, sub(node)[i]);
+                }
+        }
+        return rank;
+}
+
+/*
+小于key的键值个数，key存在时即key从0开始的排名
+需要BPLUS_TREE_COUNTS模式，否则返回-1
+*/
+long bplus_tree_rank(struct bplus_tree *tree, key_t key)
+{
+        if (!(tree->flags & BPLUS_TREE_COUNTS)) {
+                return -1;
+        }
+        return key_rank(tree, key, 0);
+}
+
+/*
+key1到key2之间(包含两端)的键值个数
+两次排名查找相减，不遍历叶子节点
+需要BPLUS_TREE_COUNTS模式，否则返回-1
+*/
+long bplus_tree_count_range(struct bplus_tree *tree, key_t key1, key_t key2)
+{
+        key_t min = key1 <= key2 ? key1 : key2;
+        key_t max = min == key1 ? key2 : key1;
+
+        if (!(tree->flags & BPLUS_TREE_COUNTS)) {
+                return -1;
+        }
+        return key_rank(tree, max, 1) - key_rank(tree, min, 0);
+}
+
+/*
+按排名查找，得到第k个(从0开始)最小的键值和数据
+从根节点到叶子节点查找一次，按分支计数选择分支
+key_t *key--------------------返回的键值，可以为NULL
+long *data--------------------返回的数据，可以为NULL
+返回--------------------------成功返回0，k越界或不是BPLUS_TREE_COUNTS模式返回-1
+*/
+int bplus_tree_select(struct bplus_tree *tree, long k, key_t *key, long *data)
+{
+        if (!(tree->flags & BPLUS_TREE_COUNTS) || k < 0) {
+                return -1;
+        }
+
+        struct bplus_node *node = node_seek(tree, tree->root);
+        while (node != NULL) {
+                if (is_leaf(node)) {
+                        if (k >= node->children) {
+                                return -1;
+                        }
+                        if (key != NULL) {
+                                *key = key(node)[k];
+                        }
+                        if (data != NULL) {
+                                *data = data(node)[k];
+                        }
+                        return 0;
+                } else {
+                        int i;
+                        for (i = 0; i < node->children - 1 && k >= count(node)[i]; i++) {
+                                k -= count(node)[i];
+                        }
+                        node = node_seek(tree, sub(node)[i]);
+                }
+        }
+        return -1;
+}
+
+/*
+预读同一父节点下的若干个孩子节点，通知内核将要读取
+偏移量连续的孩子合并为一次请求
+struct bplus_node *parent-----父节点
+int from----------------------第一个预读的孩子位置
+int to------------------------最后一个预读的孩子位置之后
+*/
+static void sub_readahead(struct bplus_tree *tree, struct bplus_node *parent, int from, int to)
+{
+        /*O_DIRECT模式不经过页缓存，预读没有意义*/
+        if (tree->flags & BPLUS_TREE_DIRECT) {
+                return;
+        }
+        while (from < to) {
+                off_t start = sub(parent)[from];
+                off_t len = _block_size;
+                /*合并偏移量连续的孩子*/
+                while (++from < to && sub(parent)[from] == start + len) {
+                        len += _block_size;
+                }
+                posix_fadvise(tree->fd, start, len, POSIX_FADV_WILLNEED);
         }
 }
 
 /*
-非叶子节点的分裂插入
-insert在spilit左边,insert<spilit
-struct bplus_tree *tree------------------B+树信息结构体
-struct bplus_node *node------------------原节点
-struct bplus_node *left------------------新分裂的节点
-struct bplus_node *l_ch------------------左孩子
-struct bplus_node *r_ch------------------右孩子
-key_t key--------------------------------键值
-int insert-------------------------------插入位置
+顺序扫描的预读
+当前位置接近已预读的末尾时，继续预读后面window个兄弟叶子节点，并将预读窗口加倍，最大READAHEAD_MAX
+预读到父节点末尾时，同时预读父节点的右兄弟，转到下一个父节点时不需要等待
+int c-------------------------当前叶子节点在父节点中的位置
+int *ahead--------------------父节点中下一个未预读的孩子位置
+int *window-------------------预读窗口大小
 */
-static key_t non_leaf_split_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+static void scan_readahead(struct bplus_tree *tree, struct bplus_node *parent, int c, int *ahead, int *window)
 {
-        int i;
-        key_t split_key;
+        if (*ahead >= parent->children || *ahead - c > *window / 2) {
+                return;
+        }
 
-        /*分裂边界spilit=(len+1)/2*/
-        int split = (_max_order + 1) / 2;
+        int from = *ahead > c + 1 ? *ahead : c + 1;
+        int to = from + *window < parent->children ? from + *window : parent->children;
+        sub_readahead(tree, parent, from, to);
+        if (to == parent->children && parent->next != INVALID_OFFSET && !(tree->flags & BPLUS_TREE_DIRECT)) {
+                posix_fadvise(tree->fd, parent->next, _block_size, POSIX_FADV_WILLNEED);
+        }
+        *ahead = to;
+        if (*window < READAHEAD_MAX) {
+                *window *= 2;
+        }
+}
 
-        /*左节点添加到树*/
-        left_node_add(tree, node, left);
+/*
+获取范围，返回key1到key2之间最后一个键值的数据
+沿叶子节点的next指针扫描，扫描持续时预读窗口逐渐增大
+*/
+long bplus_tree_get_range(struct bplus_tree *tree, key_t key1, key_t key2)
+{
+        long start = -1;
+        off_t path[MAX_DEPTH];
+        key_t min = key1 <= key2 ? key1 : key2;
+        key_t max = min == key1 ? key2 : key1;
 
-        /*重新计算左右兄弟节点的孩子*/
-        int pivot = insert;
-        left->children = split;
-        node->children = _max_order - split + 1;
+        if (tree->root == INVALID_OFFSET) {
+                return -1;
+        }
 
-        /*将原来的insert~spilit的key和data复制到分裂的左兄弟*/
-        memmove(&key(left)[0], &key(node)[0], pivot * sizeof(key_t));
-        memmove(&sub(left)[0], &sub(node)[0], pivot * sizeof(off_t));
+        /*找到min所在的叶子节点和它的父节点*/
+        int depth = path_search(tree, min, path);
+        struct bplus_node *parent = depth > 1 ? node_fetch(tree, path[depth - 2]) : NULL;
+        int c = parent != NULL ? parent_sub_index(parent, path[depth - 1]) : 0;
+        int ahead = c + 1, window = READAHEAD_MIN;
+        struct bplus_node *node = node_seek(tree, path[depth - 1]);
 
-        /*将原来的insert+1~end的key和data后移1位，方便插入*/
-        memmove(&key(left)[pivot + 1], &key(node)[pivot], (split - pivot - 1) * sizeof(key_t));
-        memmove(&sub(left)[pivot + 1], &sub(node)[pivot], (split - pivot - 1) * sizeof(off_t));
+        int i = key_binary_search(tree, node, min);
+        if (i < 0) {
+                i = -i - 1;
+        }
+        if (parent != NULL) {
+                scan_readahead(tree, parent, c, &ahead, &window);
+        }
 
-        /*将分裂的左节点的孩子重定向，写入.index*/
-        for (i = 0; i < left->children; i++) {
-                if (i != pivot && i != pivot + 1) {
-                        sub_node_flush(tree, left, sub(left)[i]);
+        /*延迟删除模式下叶子节点可能为空，越过末尾就转到下一个叶子节点*/
+        while (node != NULL) {
+                if (i >= node->children) {
+                        /*叶子节点不占用缓存，先记住偏移量*/
+                        off_t next_leaf = node->next;
+                        if (next_leaf == INVALID_OFFSET) {
+                                break;
+                        }
+                        if (parent != NULL && ++c >= parent->children) {
+                                struct bplus_node *next = node_fetch(tree, parent->next);
+                                cache_defer(tree, parent);
+                                parent = next;
+                                c = 0;
+                                ahead = 0;
+                        }
+                        node = node_seek(tree, next_leaf);
+                        i = 0;
+                } else if (key(node)[i] <= max) {
+                        /*开始读取一个叶子节点时预读后面的叶子节点*/
+                        if (i == 0 && parent != NULL) {
+                                scan_readahead(tree, parent, c, &ahead, &window);
+                        }
+                        start = data(node)[i++];
+                } else {
+                        break;
                 }
         }
 
-        /*插入新键和子节点，并找到拆分键*/
-        key(left)[pivot] = key;
-		/*
-		插入的非叶子节点有左右两孩子
-		判断他们在分裂边界的那一边
-		pivot == split - 1：孩子节点在分裂边界的两边
-		else：孩子节点均在分裂节点左边
-		*/
-        if (pivot == split - 1) {
-                /*
-				孩子节点在分裂边界的两边
-				更新索引，l_ch放到新分裂的非叶子节点
-				r_ch放到原非叶子节点
-				*/
-                sub_node_update(tree, left, pivot, l_ch);
-                sub_node_update(tree, node, 0, r_ch);
-                split_key = key;
-        } else {
-                /*
-				两个新的子节点在分裂左节点
-				更新索引，l_ch和r_ch均放到新分裂的非叶子节点
-				*/
-                sub_node_update(tree, left, pivot, l_ch);
-                sub_node_update(tree, left, pivot + 1, r_ch);
-                sub(node)[0] = sub(node)[split - 1];
-                split_key = key(node)[split - 2];
+        if (parent != NULL) {
+                cache_defer(tree, parent);
         }
-
-        /*将原节点分裂边界右边的key和ptr左移*/
-        memmove(&key(node)[0], &key(node)[split - 1], (node->children - 1) * sizeof(key_t));
-        memmove(&sub(node)[1], &sub(node)[split], (node->children - 1) * sizeof(off_t));
-
-		/*返回前继节点，作为上一层键值*/
-        return split_key;
+        return start;
 }
 
 /*
-非叶子节点的分裂插入
-insert与spilit重叠，insert==spilit
-直接分裂，移动操作减少
-struct bplus_tree *tree------------------B+树信息结构体
-struct bplus_node *node------------------原节点
-struct bplus_node *right-----------------新分裂的节点
-struct bplus_node *l_ch------------------左孩子
-struct bplus_node *r_ch------------------右孩子
-key_t key--------------------------------键值
-int insert-------------------------------插入位置
+升序范围扫描，沿叶子节点的next指针从min向max读取，最多读取max_num个数据
+每到一个新的父节点，预读右边还需要的兄弟叶子节点，预读个数不超过剩余数据需要的叶子节点个数
 */
-static key_t non_leaf_split_right1(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+static int range_scan_asc(struct bplus_tree *tree, key_t min, key_t max, key_t *keys, long *data, int max_num)
 {
-        int i;
-
-        /*分裂边界spilit=(len+1)/2*/
-        int split = (_max_order + 1) / 2;
+        int n = 0;
+        off_t path[MAX_DEPTH];
 
-        /*新分裂的节点添加到树*/
-        right_node_add(tree, node, right);
-
-        /*上一层的键值*/
-        key_t split_key = key(node)[split - 1];
+        if (tree->root == INVALID_OFFSET || max_num <= 0) {
+                return 0;
+        }
 
-        /*重新计算孩子个数*/
-        int pivot = 0;
-        node->children = split;
-        right->children = _max_order - split + 1;
+        /*找到min所在的叶子节点和它的父节点*/
+        int depth = path_search(tree, min, path);
+        struct bplus_node *parent = depth > 1 ? node_fetch(tree, path[depth - 2]) : NULL;
+        int c = parent != NULL ? parent_sub_index(parent, path[depth - 1]) : 0;
+        struct bplus_node *node = node_seek(tree, path[depth - 1]);
 
-        /*插入key和ptr*/
-        key(right)[0] = key;
-        sub_node_update(tree, right, pivot, l_ch);
-        sub_node_update(tree, right, pivot + 1, r_ch);
+        int i = key_binary_search(tree, node, min);
+        i = i >= 0 ? i : -i - 1;
 
-         /*复制数据到新的分裂节点*/
-        memmove(&key(right)[pivot + 1], &key(node)[split], (right->children - 2) * sizeof(key_t));
-        memmove(&sub(right)[pivot + 2], &sub(node)[split + 1], (right->children - 2) * sizeof(off_t));
+        if (parent != NULL) {
+                int need = (max_num - 1) / _max_entries + 1;
+                sub_readahead(tree, parent, c + 1, c + 1 + need < parent->children ? c + 1 + need : parent->children);
+        }
 
-        /*重定向父子结点，写入.index*/
-        for (i = pivot + 2; i < right->children; i++) {
-                sub_node_flush(tree, right, sub(right)[i]);
+        while (n < max_num) {
+                if (i >= node->children) {
+                        /*当前叶子节点读完，转到右兄弟，叶子节点不占用缓存，先记住偏移量*/
+                        off_t next_leaf = node->next;
+                        if (next_leaf == INVALID_OFFSET) {
+                                break;
+                        }
+                        if (parent != NULL && ++c >= parent->children) {
+                                /*右兄弟属于父节点的右兄弟，预读新父节点下还需要的叶子节点*/
+                                struct bplus_node *next = node_fetch(tree, parent->next);
+                                cache_defer(tree, parent);
+                                parent = next;
+                                c = 0;
+                                int need = (max_num - n - 1) / _max_entries + 1;
+                                sub_readahead(tree, parent, 0, need < parent->children ? need : parent->children);
+                        }
+                        node = node_seek(tree, next_leaf);
+                        i = 0;
+                } else if (key(node)[i] <= max) {
+                        if (keys != NULL) {
+                                keys[n] = key(node)[i];
+                        }
+                        if (data != NULL) {
+                                data[n] = data(node)[i];
+                        }
+                        n++;
+                        i++;
+                } else {
+                        break;
+                }
         }
 
-		/*返回上一层键值*/
-        return split_key;
+        if (parent != NULL) {
+                cache_defer(tree, parent);
+        }
+        return n;
 }
 
 /*
-非叶子节点的分裂插入
-insert在spilit右边,insert>spilit
-struct bplus_tree *tree------------------B+树信息结构体
-struct bplus_node *node------------------原节点
-struct bplus_node *right-----------------新分裂的节点
-struct bplus_node *l_ch------------------左孩子
-struct bplus_node *r_ch------------------右孩子
-key_t key--------------------------------键值
-int insert-------------------------------插入位置
+降序范围扫描，沿叶子节点的prev指针从max向min读取，最多读取max_num个数据
+每到一个新的父节点，预读左边还需要的兄弟叶子节点，预读个数不超过剩余数据需要的叶子节点个数
 */
-static key_t non_leaf_split_right2(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+static int range_scan_desc(struct bplus_tree *tree, key_t min, key_t max, key_t *keys, long *data, int max_num)
 {
-        int i;
+        int n = 0;
+        off_t path[MAX_DEPTH];
 
-        /*分裂边界spilit=(len+1)/2*/
-        int split = (_max_order + 1) / 2;
+        if (tree->root == INVALID_OFFSET || max_num <= 0) {
+                return 0;
+        }
 
-        /*右节点添加到树*/
-        right_node_add(tree, node, right);
+        /*找到max所在的叶子节点和它的父节点*/
+        int depth = path_search(tree, max, path);
+        struct bplus_node *parent = depth > 1 ? node_fetch(tree, path[depth - 2]) : NULL;
+        int c = parent != NULL ? parent_sub_index(parent, path[depth - 1]) : 0;
+        struct bplus_node *node = node_seek(tree, path[depth - 1]);
 
-        /*上一层的键值*/
-        key_t split_key = key(node)[split];
+        int i = key_binary_search(tree, node, max);
+        i = i >= 0 ? i : -i - 2;
 
-        /*重新计算孩子个数*/
-        int pivot = insert - split - 1;
-        node->children = split + 1;
-        right->children = _max_order - split;
+        if (parent != NULL) {
+                int need = (max_num - 1) / _max_entries + 1;
+                sub_readahead(tree, parent, c > need ? c - need : 0, c);
+        }
 
-        /*复制数据到新的分裂节点*/
-        memmove(&key(right)[0], &key(node)[split + 1], pivot * sizeof(key_t));
-        memmove(&sub(right)[0], &sub(node)[split + 1], pivot * sizeof(off_t));
+        while (n < max_num) {
+                if (i < 0) {
+                        /*当前叶子节点读完，转到左兄弟，叶子节点不占用缓存，先记住偏移量*/
+                        off_t prev_leaf = node->prev;
+                        if (prev_leaf == INVALID_OFFSET) {
+                                break;
+                        }
+                        if (parent != NULL && --c < 0) {
+                                /*左兄弟属于父节点的左兄弟，预读新父节点下还需要的叶子节点*/
+                                struct bplus_node *prev = node_fetch(tree, parent->prev);
+                                cache_defer(tree, parent);
+                                parent = prev;
+                                c = parent->children - 1;
+                                int need = (max_num - n - 1) / _max_entries + 1;
+                                sub_readahead(tree, parent, c + 1 > need ? c + 1 - need : 0, c + 1);
+                        }
+                        node = node_seek(tree, prev_leaf);
+                        i = node->children - 1;
+                } else if (key(node)[i] >= min) {
+                        if (keys != NULL) {
+                                keys[n] = key(node)[i];
+                        }
+                        if (data != NULL) {
+                                data[n] = data(node)[i];
+                        }
+                        n++;
+                        i--;
+                } else {
+                        break;
+                }
+        }
 
-        /*插入key和ptr，更新索引*/
-        key(right)[pivot] = key;
-        sub_node_update(tree, right, pivot, l_ch);
-        sub_node_update(tree, right, pivot + 1, r_ch);
+        if (parent != NULL) {
+                cache_defer(tree, parent);
+        }
+        return n;
+}
 
-        /*将原节点insert+1~end的数据移动到新分裂的非叶子节点*/
-        memmove(&key(right)[pivot + 1], &key(node)[insert], (_max_order - insert - 1) * sizeof(key_t));
-        memmove(&sub(right)[pivot + 2], &sub(node)[insert + 1], (_max_order - insert - 1) * sizeof(off_t));
+/*
+降序范围查找，从大到小返回key1到key2之间(包含两端)的键值和数据
+key_t *keys-------------------返回的键值，可以为NULL
+long *data--------------------返回的数据，可以为NULL
+int max-----------------------最多返回的个数
+返回--------------------------返回的个数
+*/
+int bplus_tree_get_range_desc(struct bplus_tree *tree, key_t key1, key_t key2, key_t *keys, long *data, int max)
+{
+        key_t min = key1 <= key2 ? key1 : key2;
+        key_t max_key = min == key1 ? key2 : key1;
+        return range_scan_desc(tree, min, max_key, keys, data, max);
+}
 
-        /*重定向父子结点，写入.index*/
-        for (i = 0; i < right->children; i++) {
-                if (i != pivot && i != pivot + 1) {
-                        sub_node_flush(tree, right, sub(right)[i]);
+/*
+叶子节点中不大于max的数据的结束位置，叶子节点内的数据按键值有序，范围内的数据是连续的一段
+struct bplus_search_stats *stats---查找的统计信息，其他线程中调用时为NULL
+*/
+static inline int leaf_slice_end(struct bplus_tree *tree, struct bplus_node *leaf, key_t max, struct bplus_search_stats *stats)
+{
+        if (leaf->children == 0 || key(leaf)[leaf->children - 1] <= max) {
+                return leaf->children;
+        }
+        int i = key_search(leaf, max, tree->search_mode, stats);
+        return i >= 0 ? i + 1 : -i - 1;
+}
+
+/*
+SIMD内核：聚合连续的n个数据中满足lo <= data <= hi的值
+每次比较SIMD_LANES个数据，比较结果是每个通道全1或全0的掩码，用掩码累加个数和总和、选择最小值和最大值，没有分支
+不足一个向量的数据，以及没有向量类型时的全部数据逐个处理
+*/
+static void simd_aggregate(const long *data, int n, long lo, long hi, struct bplus_aggregate *acc)
+{
+        int i = 0;
+
+#ifdef SIMD_LANES
+        vec_long zero = { 0 };
+        vec_long vlo = zero + lo, vhi = zero + hi;
+        vec_long cnt = zero, sum = zero, vmin = zero + LONG_MAX, vmax = zero + LONG_MIN;
+        int j;
+
+        for (; i + SIMD_LANES <= n; i += SIMD_LANES) {
+                vec_long d, m, lt, gt;
+                memcpy(&d, data + i, sizeof(d));
+                m = (d >= vlo) & (d <= vhi);
+                cnt -= m;
+                sum += d & m;
+                lt = (d < vmin) & m;
+                vmin = (d & lt) | (vmin & ~lt);
+                gt = (d > vmax) & m;
+                vmax = (d & gt) | (vmax & ~gt);
+        }
+        for (j = 0; j < SIMD_LANES; j++) {
+                acc->count += cnt[j];
+                acc->sum += sum[j];
+                if (vmin[j] < acc->min) {
+                        acc->min = vmin[j];
+                }
+                if (vmax[j] > acc->max) {
+                        acc->max = vmax[j];
+                }
+        }
+#endif
+
+        for (; i < n; i++) {
+                long d = data[i];
+                if (d >= lo && d <= hi) {
+                        acc->count++;
+                        acc->sum += d;
+                        if (d < acc->min) {
+                                acc->min = d;
+                        }
+                        if (d > acc->max) {
+                                acc->max = d;
+                        }
                 }
         }
+}
 
-		/*返回上一层键值*/
-        return split_key;
+/*
+SIMD内核：输出连续的n个数据中满足lo <= data <= hi的键值和数据
+每次比较SIMD_LANES个数据，整组都不满足时直接跳过，否则按掩码输出满足的通道
+返回--------------------------输出的个数，不超过max
+*/
+static int simd_filter(const key_t *keys, const long *data, int n, long lo, long hi, key_t *out_keys, long *out_data, int max)
+{
+        int i = 0, c = 0;
+
+#ifdef SIMD_LANES
+        vec_long zero = { 0 };
+        vec_long vlo = zero + lo, vhi = zero + hi;
+        int j;
+
+        for (; i + SIMD_LANES <= n && c < max; i += SIMD_LANES) {
+                vec_long d, m;
+                long any = 0;
+                memcpy(&d, data + i, sizeof(d));
+                m = (d >= vlo) & (d <= vhi);
+                for (j = 0; j < SIMD_LANES; j++) {
+                        any |= m[j];
+                }
+                if (!any) {
+                        continue;
+                }
+                for (j = 0; j < SIMD_LANES && c < max; j++) {
+                        if (m[j]) {
+                                if (out_keys != NULL) {
+                                        out_keys[c] = keys[i + j];
+                                }
+                                if (out_data != NULL) {
+                                        out_data[c] = data[i + j];
+                                }
+                                c++;
+                        }
+                }
+        }
+#endif
+
+        for (; i < n && c < max; i++) {
+                if (data[i] >= lo && data[i] <= hi) {
+                        if (out_keys != NULL) {
+                                out_keys[c] = keys[i];
+                        }
+                        if (out_data != NULL) {
+                                out_data[c] = data[i];
+                        }
+                        c++;
+                }
+        }
+        return c;
 }
 
 /*
-父节点未满时，非叶子节点的简单插入
-struct bplus_tree *tree----------------B+树信息结构体
-struct bplus_node *node----------------父节点
-struct bplus_node *l_ch----------------左孩子
-struct bplus_node *r_ch----------------右孩子
-key_t key------------------------------键值
-int insert-----------------------------插入位置
+按上层非叶子节点的分隔键值划分[min,max]
+从根节点开始逐层沿next指针收集落在范围内的分隔键值，不够want-1个时下降一层，最多到叶子节点的父节点
+分隔键值多于需要时均匀挑选
+key_t *bounds-----------------返回的分区边界，bounds[0]为min，最多want个
+返回--------------------------分区个数
 */
-static void non_leaf_simple_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key, int insert)
+static int scan_partition(struct bplus_tree *tree, key_t min, key_t max, int want, key_t *bounds)
 {
-		/*将insert处原来的值后移*/
-        memmove(&key(node)[insert + 1], &key(node)[insert], (node->children - 1 - insert) * sizeof(key_t));
-        memmove(&sub(node)[insert + 2], &sub(node)[insert + 1], (node->children - 1 - insert) * sizeof(off_t));
-        
-		/*在insert处插入键值，并更新索引*/
-        key(node)[insert] = key;
-        sub_node_update(tree, node, insert, l_ch);
-        sub_node_update(tree, node, insert + 1, r_ch);
-        node->children++;
+        off_t path[MAX_DEPTH];
+        key_t *seps = NULL;
+        int i, j, d, n = 0, cap = 0, parts = 1;
+        int depth = path_search(tree, min, path);
+
+        for (d = 0; d < depth - 1; d++) {
+                off_t offset = path[d];
+                int done = 0;
+                n = 0;
+                while (offset != INVALID_OFFSET && !done) {
+                        struct bplus_node *node = node_seek(tree, offset);
+                        for (j = 0; j < node->children - 1; j++) {
+                                key_t k = key(node)[j];
+                                if (k > max) {
+                                        done = 1;
+                                        break;
+                                }
+                                if (k <= min) {
+                                        continue;
+                                }
+                                if (n == cap) {
+                                        cap = cap * 2 + 64;
+                                        seps = realloc(seps, cap * sizeof(key_t));
+                                        assert(seps != NULL);
+                                }
+                                seps[n++] = k;
+                        }
+                        offset = node->next;
+                }
+                if (n >= want - 1) {
+                        break;
+                }
+        }
+
+        bounds[0] = min;
+        for (i = 0; i < want - 1 && i < n; i++) {
+                bounds[parts++] = seps[n <= want - 1 ? i : (long) (i + 1) * n / want];
+        }
+        free(seps);
+        return parts;
+}
+
+/*
+扫描线程读取节点，使用线程自己的缓冲区，不占用B+树的节点缓存
+*/
+static struct bplus_node *scan_node_read(struct bplus_tree *tree, char *buf, off_t offset)
+{
+        int len = pread(tree->fd, buf, _block_size, offset);
+        assert(len == _block_size);
+        return (struct bplus_node *) buf;
 }
 
 /*
-非叶子节点插入，定义
-即生成新的父节点
-struct bplus_tree *tree-------------B+树信息结构体
-struct bplus_node *node-------------要接入的新的B+树兄弟叶子节点
-struct bplus_node *l_ch-------------B+树左孩子节点
-struct bplus_node *r_ch-------------B+树右孩子节点
-key_t key
+扫描一个分区，聚合lo到hi之间的数据
+从根节点查找到lo所在的叶子节点，保留它的父节点用于预读，之后沿next指针扫描
+char *buf---------------------线程的缓冲区，两个区块：叶子节点和父节点
 */
-static int non_leaf_insert(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *l_ch, struct bplus_node *r_ch, key_t key)
+static void scan_part(struct bplus_tree *tree, char *buf, key_t lo, key_t hi, struct bplus_aggregate *acc)
 {
-        /*键值二分查找*/
-        int insert = key_binary_search(node, key);
-        assert(insert < 0);
-        insert = -insert - 1;
+        struct bplus_node *node = scan_node_read(tree, buf, tree->root);
+        struct bplus_node *parent = NULL;
+        int i, c = 0, ahead = 0, window = READAHEAD_MIN;
+
+        /*两个缓冲区交替使用，到达叶子节点时另一个缓冲区是它的父节点*/
+        while (!is_leaf(node)) {
+                i = key_search(node, lo, tree->search_mode, NULL);
+                c = i >= 0 ? i + 1 : -i - 1;
+                parent = node;
+                node = scan_node_read(tree, (char *) parent == buf ? buf + _block_size : buf, sub(parent)[c]);
+        }
+        if (parent != NULL) {
+                ahead = c + 1;
+                scan_readahead(tree, parent, c, &ahead, &window);
+        }
 
-        /*父节点满，进行分裂*/
-        if (node->children == _max_order) {
-                key_t split_key;
-                /*分裂边界spilit=(len+1)/2*/
-                int split = (node->children + 1) / 2;
-				/*生成一个新的分裂的非叶子节点*/
-                struct bplus_node *sibling = non_leaf_new(tree);
-                if (insert < split) {
-                        split_key = non_leaf_split_left(tree, node, sibling, l_ch, r_ch, key, insert);
-                } else if (insert == split) {
-                        split_key = non_leaf_split_right1(tree, node, sibling, l_ch, r_ch, key, insert);
-                } else {
-                        split_key = non_leaf_split_right2(tree, node, sibling, l_ch, r_ch, key, insert);
-                }
+        i = key_search(node, lo, tree->search_mode, NULL);
+        i = i >= 0 ? i : -i - 1;
+        for (;;) {
+                /*叶子节点内范围内的数据是连续的一段，整段交给SIMD内核*/
+                int end = leaf_slice_end(tree, node, hi, NULL);
+                simd_aggregate(data(node) + i, end - i, LONG_MIN, LONG_MAX, acc);
 
-                /*再次建立新的父节点*/
-                if (insert < split) {
-                        return parent_node_build(tree, sibling, node, split_key);
-                } else {
-                        return parent_node_build(tree, node, sibling, split_key);
+                off_t next_leaf = node->next;
+                if (end < node->children || next_leaf == INVALID_OFFSET) {
+                        break;
+                }
+                if (parent != NULL && ++c >= parent->children) {
+                        parent = scan_node_read(tree, (char *) parent, parent->next);
+                        c = 0;
+                        ahead = 0;
+                }
+                node = scan_node_read(tree, (char *) node, next_leaf);
+                i = 0;
+                if (parent != NULL) {
+                        scan_readahead(tree, parent, c, &ahead, &window);
                 }
-		/*父节点未满，进行简单的非叶子节点插入，并保存*/
-        } else {
-                non_leaf_simple_insert(tree, node, l_ch, r_ch, key, insert);
-                node_flush(tree, node);
         }
-        return 0;
 }
 
 /*
-节点分裂插入，插入位置在分裂位置的左边
-与leaf_split_right类似
-struct bplus_tree *tree-----------B+树信息结构体
-struct bplus_node *leaf-----------B+树叶子节点
-struct bplus_node *left-----------新的叶子节点
-key_t key-------------------------键值
-long data-------------------------数据
-int insert------------------------插入位置
+并行扫描线程，每次取一个分区扫描，全部扫描完后把部分结果合并到任务中
 */
-static key_t leaf_split_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, key_t key, long data, int insert)
+static void *scan_worker(void *arg)
 {
-        /*分裂边界split=(len+1)/2*/
-        int split = (leaf->children + 1) / 2;
-
-        /*节点分裂，设置左右兄弟叶子节点的指向*/
-        left_node_add(tree, leaf, left);
+        struct scan_job *job = arg;
+        struct bplus_aggregate acc = { 0, 0, LONG_MAX, LONG_MIN };
+        char *buf;
+
+        /*缓冲区申请失败时停止所有线程取分区*/
+        if (posix_memalign((void **) &buf, DIRECT_IO_ALIGN, _block_size * 2) != 0) {
+                pthread_mutex_lock(&job->lock);
+                job->next = job->parts;
+                job->error = 1;
+                pthread_mutex_unlock(&job->lock);
+                return NULL;
+        }
+        for (;;) {
+                pthread_mutex_lock(&job->lock);
+                int p = job->next++;
+                pthread_mutex_unlock(&job->lock);
+                if (p >= job->parts) {
+                        break;
+                }
+                key_t hi = p + 1 < job->parts ? job->bounds[p + 1] - 1 : job->max;
+                scan_part(job->tree, buf, job->bounds[p], hi, &acc);
+        }
+        free(buf);
 
-		/*重新设置children的数值*/
-        int pivot = insert;
-        left->children = split;
-        leaf->children = _max_entries - split + 1;
+        pthread_mutex_lock(&job->lock);
+        job->result.count += acc.count;
+        job->result.sum += acc.sum;
+        if (acc.min < job->result.min) {
+                job->result.min = acc.min;
+        }
+        if (acc.max > job->result.max) {
+                job->result.max = acc.max;
+        }
+        pthread_mutex_unlock(&job->lock);
+        return NULL;
+}
 
-        /*
-		将原叶子节点key[0]-key[insert]的数值复制到左边分裂出的新的叶子节点
-		将原叶子节点data[0]-data[insert]的数值复制到左边分裂出的新的叶子节点
-		*/
-        memmove(&key(left)[0], &key(leaf)[0], pivot * sizeof(key_t));
-        memmove(&data(left)[0], &data(leaf)[0], pivot * sizeof(long));
+/*
+多线程并行的范围聚合，统计key1到key2之间(包含两端)的键值个数和数据的和、最小值、最大值
+范围按上层非叶子节点的分隔键值分成threads*SCAN_PARTS_PER_THREAD个分区，线程各自读取节点和预读，不使用B+树的节点缓存
+扫描期间不能修改B+树，多值模式和值日志模式的数据是编码，不能聚合
+int threads-------------------线程个数，小于等于1时在当前线程扫描
+返回--------------------------成功返回0，出错返回-1
+*/
+int bplus_tree_aggregate(struct bplus_tree *tree, key_t key1, key_t key2, int threads, struct bplus_aggregate *result)
+{
+        struct scan_job job;
+        int k;
 
-        /*在insert处插入新的key和data*/
-        key(left)[pivot] = key;
-        data(left)[pivot] = data;
+        memset(result, 0, sizeof(*result));
+        if (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG)) {
+                return -1;
+        }
+        if (tree->root == INVALID_OFFSET) {
+                return 0;
+        }
 
-        /*从原叶子节点将insert到split的值放到新的叶子节点insert+1处*/
-        memmove(&key(left)[pivot + 1], &key(leaf)[pivot], (split - pivot - 1) * sizeof(key_t));
-        memmove(&data(left)[pivot + 1], &data(leaf)[pivot], (split - pivot - 1) * sizeof(long));
+        threads = threads < 1 ? 1 : threads;
+        job.tree = tree;
+        job.max = key1 <= key2 ? key2 : key1;
+        job.bounds = malloc(threads * SCAN_PARTS_PER_THREAD * sizeof(key_t));
+        assert(job.bounds != NULL);
+        job.parts = scan_partition(tree, key1 <= key2 ? key1 : key2, job.max, threads * SCAN_PARTS_PER_THREAD, job.bounds);
+        job.next = 0;
+        job.result.count = 0;
+        job.result.sum = 0;
+        job.result.min = LONG_MAX;
+        job.result.max = LONG_MIN;
+        job.error = 0;
+        pthread_mutex_init(&job.lock, NULL);
+
+        if (threads > job.parts) {
+                threads = job.parts;
+        }
+        if (threads == 1) {
+                scan_worker(&job);
+        } else {
+                pthread_t *workers = malloc(threads * sizeof(pthread_t));
+                assert(workers != NULL);
+                int started;
+                for (started = 0; started < threads; started++) {
+                        if (pthread_create(&workers[started], NULL, scan_worker, &job) != 0) {
+                                /*创建失败，已创建的线程不再取新的分区*/
+                                pthread_mutex_lock(&job.lock);
+                                job.next = job.parts;
+                                job.error = 1;
+                                pthread_mutex_unlock(&job.lock);
+                                break;
+                        }
+                }
+                for (k = 0; k < started; k++) {
+                        pthread_join(workers[k], NULL);
+                }
+                free(workers);
+        }
+        pthread_mutex_destroy(&job.lock);
+        free(job.bounds);
 
-        /*将原叶子节点insert+1~end的key和data复制到原叶子节点key[0]*/
-        memmove(&key(leaf)[0], &key(leaf)[split - 1], leaf->children * sizeof(key_t));
-        memmove(&data(leaf)[0], &data(leaf)[split - 1], leaf->children * sizeof(long));
-		
-		/*返回后继节点的key，即原叶子节点现在的key[0]*/
-        return key(leaf)[0];
+        if (job.error) {
+                return -1;
+        }
+        if (job.result.count > 0) {
+                *result = job.result;
+        }
+        return 0;
 }
 
 /*
-节点分裂插入，插入位置在分裂位置的右边
-与leaf_split_left类似
-struct bplus_tree *tree-----------B+树信息结构体
-struct bplus_node *leaf-----------B+树叶子节点
-struct bplus_node *right----------新的叶子节点
-key_t key-------------------------键值
-long data-------------------------数据
-int insert------------------------插入位置
+沿叶子节点扫描min到max之间的数据，每个叶子节点内范围内的数据是连续的一段，整段交给fn处理
+叶子节点内的起止位置用二分查找确定，不逐个比较键值，预读同bplus_tree_get_range
+fn----------------------------处理叶子节点中from到to之前的数据，返回非0时停止扫描
 */
-static key_t leaf_split_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, key_t key, long data, int insert)
+static void leaf_slice_scan(struct bplus_tree *tree, key_t min, key_t max,
+                            int (*fn)(struct bplus_node *leaf, int from, int to, void *arg), void *arg)
 {
-        /*分裂边界split=(len+1)/2*/
-        int split = (leaf->children + 1) / 2;
+        off_t path[MAX_DEPTH];
 
-        /*节点分裂，设置左右兄弟叶子节点的指向*/
-        right_node_add(tree, leaf, right);
+        if (tree->root == INVALID_OFFSET) {
+                return;
+        }
 
-        /*重新设置children的数值*/
-        int pivot = insert - split;
-        leaf->children = split;
-        right->children = _max_entries - split + 1;
+        /*找到min所在的叶子节点和它的父节点*/
+        int depth = path_search(tree, min, path);
+        struct bplus_node *parent = depth > 1 ? node_fetch(tree, path[depth - 2]) : NULL;
+        int c = parent != NULL ? parent_sub_index(parent, path[depth - 1]) : 0;
+        int ahead = c + 1, window = READAHEAD_MIN;
+        struct bplus_node *node = node_seek(tree, path[depth - 1]);
+
+        int i = key_binary_search(tree, node, min);
+        i = i >= 0 ? i : -i - 1;
+        if (parent != NULL) {
+                scan_readahead(tree, parent, c, &ahead, &window);
+        }
 
-        /*将原叶子节点spilt~insert的key和data复制到右边分裂出的新的叶子节点*/
-        memmove(&key(right)[0], &key(leaf)[split], pivot * sizeof(key_t));
-        memmove(&data(right)[0], &data(leaf)[split], pivot * sizeof(long));
+        for (;;) {
+                int end = leaf_slice_end(tree, node, max, &tree->search_stats);
+                if (end > i && fn(node, i, end, arg)) {
+                        break;
+                }
 
-        /*在insert处插入新的key和data*/
-        key(right)[pivot] = key;
-        data(right)[pivot] = data;
+                /*叶子节点不占用缓存，先记住偏移量*/
+                off_t next_leaf = node->next;
+                if (end < node->children || next_leaf == INVALID_OFFSET) {
+                        break;
+                }
+                if (parent != NULL && ++c >= parent->children) {
+                        struct bplus_node *next = node_fetch(tree, parent->next);
+                        cache_defer(tree, parent);
+                        parent = next;
+                        c = 0;
+                        ahead = 0;
+                }
+                node = node_seek(tree, next_leaf);
+                i = 0;
+                if (parent != NULL) {
+                        scan_readahead(tree, parent, c, &ahead, &window);
+                }
+        }
 
-        /*移动剩余的数据*/
-        memmove(&key(right)[pivot + 1], &key(leaf)[insert], (_max_entries - insert) * sizeof(key_t));
-        memmove(&data(right)[pivot + 1], &data(leaf)[insert], (_max_entries - insert) * sizeof(long));
+        if (parent != NULL) {
+                cache_defer(tree, parent);
+        }
+}
 
-		/*返回后继节点的key，即分裂的叶子节点的key[0]*/
-        return key(right)[0];
+/*
+输出一段数据中满足过滤条件的键值和数据，输出满max个时停止扫描
+*/
+static int filter_slice(struct bplus_node *leaf, int from, int to, void *arg)
+{
+        struct scan_filter *f = arg;
+        f->n += simd_filter(key(leaf) + from, data(leaf) + from, to - from, f->lo, f->hi,
+                            f->keys != NULL ? f->keys + f->n : NULL, f->data != NULL ? f->data + f->n : NULL, f->max - f->n);
+        return f->n >= f->max;
 }
 
 /*
-叶子节点在未满时的简单插入
-struct bplus_tree *tree--------------------B+树信息结构体
-struct bplus_node *leaf--------------------B+树节点结构体，要插入的位置的上一个节点
-key_t key----------------------------------键值
-long data----------------------------------数据
-int intsert--------------------------------要插入的节点位序
-两个memmove是将在insert之前的数据往后存放，使得数据能够插入
+聚合一段数据中满足过滤条件的值
 */
-static void leaf_simple_insert(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, long data, int insert)
+static int aggregate_slice(struct bplus_node *leaf, int from, int to, void *arg)
 {
-        memmove(&key(leaf)[insert + 1], &key(leaf)[insert], (leaf->children - insert) * sizeof(key_t));
-        memmove(&data(leaf)[insert + 1], &data(leaf)[insert], (leaf->children - insert) * sizeof(long));
-        key(leaf)[insert] = key;
-        data(leaf)[insert] = data;
-        leaf->children++;
+        struct scan_filter *f = arg;
+        simd_aggregate(data(leaf) + from, to - from, f->lo, f->hi, &f->acc);
+        return 0;
 }
 
 /*
-插入叶子节点
-struct bplus_tree *tree--------------------B+树信息结构体
-struct bplus_node *leaf--------------------B+树节点结构体，要插入的位置的上一个节点
-key_t key----------------------------------键值
-long data----------------------------------数据
+按值过滤的范围扫描，从小到大返回key1到key2之间(包含两端)并且lo <= 数据 <= hi的键值和数据
+每个叶子节点内的数据由SIMD内核成组比较，不逐个复制和回调
+key_t *keys-------------------返回的键值，可以为NULL
+long *data--------------------返回的数据，可以为NULL
+int max-----------------------最多返回的个数
+返回--------------------------返回的个数，多值模式和值日志模式返回-1
 */
-static int leaf_insert(struct bplus_tree *tree, struct bplus_node *leaf, key_t key, long data)
+int bplus_tree_scan_filter(struct bplus_tree *tree, key_t key1, key_t key2, long lo, long hi, key_t *keys, long *data, int max)
 {
-        /*键值二分查找*/
-        int insert = key_binary_search(leaf, key);
-		/*已存在键值*/
-        if (insert >= 0) {
+        struct scan_filter f;
+
+        if (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG)) {
                 return -1;
         }
-        insert = -insert - 1;
+        if (max <= 0) {
+                return 0;
+        }
+        memset(&f, 0, sizeof(f));
+        f.lo = lo;
+        f.hi = hi;
+        f.keys = keys;
+        f.data = data;
+        f.max = max;
+        leaf_slice_scan(tree, key1 <= key2 ? key1 : key2, key1 <= key2 ? key2 : key1, filter_slice, &f);
+        return f.n;
+}
 
-        /*从空闲节点缓存中获取*/
-        int i = ((char *) leaf - tree->caches) / _block_size;
-        tree->used[i] = 1;
+/*
+按值过滤的范围聚合，统计key1到key2之间(包含两端)并且lo <= 数据 <= hi的个数、和、最小值、最大值
+不过滤时lo为LONG_MIN，hi为LONG_MAX
+返回--------------------------成功返回0，多值模式和值日志模式返回-1
+*/
+int bplus_tree_scan_aggregate(struct bplus_tree *tree, key_t key1, key_t key2, long lo, long hi, struct bplus_aggregate *result)
+{
+        struct scan_filter f;
 
-        /*叶子节点满*/
-        if (leaf->children == _max_entries) {
-                key_t split_key;
-				
-                /*节点分裂边界split=(len+1)/2*/
-                int split = (_max_entries + 1) / 2;
-                struct bplus_node *sibling = leaf_new(tree);
+        memset(result, 0, sizeof(*result));
+        if (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG)) {
+                return -1;
+        }
+        memset(&f, 0, sizeof(f));
+        f.lo = lo;
+        f.hi = hi;
+        f.acc.min = LONG_MAX;
+        f.acc.max = LONG_MIN;
+        leaf_slice_scan(tree, key1 <= key2 ? key1 : key2, key1 <= key2 ? key2 : key1, aggregate_slice, &f);
+        if (f.acc.count > 0) {
+                *result = f.acc;
+        }
+        return 0;
+}
 
-                /*
-				由插入位置决定的兄弟叶复制
-				insert < split：插入位置在分裂位置的左边
-				insert >= split：插入位置在分裂位置的右边
-				返回后继节点，以放入父节点作为键值
-				*/
-                if (insert < split) {
-                        split_key = leaf_split_left(tree, leaf, sibling, key, data, insert);
-                } else {
-                        split_key = leaf_split_right(tree, leaf, sibling, key, data, insert);
-                }
+/*
+查找小于等于key的最后n个键值，从大到小返回
+只读取n个数据所在的叶子节点
+返回--------------------------返回的个数
+*/
+int bplus_tree_get_last(struct bplus_tree *tree, key_t key, key_t *keys, long *data, int n)
+{
+        return range_scan_desc(tree, INT_MIN, key, keys, data, n);
+}
 
-                /*建立新的父节点*/
-                if (insert < split) {
-                        return parent_node_build(tree, sibling, leaf, split_key);
-                } else {
-                        return parent_node_build(tree, leaf, sibling, split_key);
-                }
-		/*叶子节点未满*/
-        } else {
-                leaf_simple_insert(tree, leaf, key, data, insert);
-                node_flush(tree, leaf);
+/*
+创建只读快照，快照看到的是创建时的B+树，之后的写操作不影响快照
+必须在写线程中两次写操作之间创建，创建后可以在其他线程读取，一个快照同一时间只能由一个线程使用
+快照存在期间，被覆盖的区块先保存旧内容，快照释放后回收
+多值模式和值日志模式的数据是编码，快照不能解码，返回NULL
+*/
+struct bplus_snapshot *bplus_tree_snapshot(struct bplus_tree *tree)
+{
+        if (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG)) {
+                return NULL;
         }
 
-        return 0;
+        struct bplus_snapshot *snap = calloc(1, sizeof(*snap));
+        assert(snap != NULL);
+        int ret = posix_memalign((void **) &snap->buf, DIRECT_IO_ALIGN, _block_size);
+        assert(ret == 0);
+        if (tree->snap_buf == NULL) {
+                ret = posix_memalign((void **) &tree->snap_buf, DIRECT_IO_ALIGN, _block_size);
+                assert(ret == 0);
+        }
+        snap->tree = tree;
+        snap->root = tree->root;
+        snap->file_size = tree->file_size;
+
+        pthread_mutex_lock(&tree->snap_lock);
+        list_add_tail(&snap->link, &tree->snapshots);
+        pthread_mutex_unlock(&tree->snap_lock);
+        return snap;
 }
 
 /*
-插入节点
+释放快照，不再被其他快照引用的副本区块交给写线程回收
 */
-static int bplus_tree_insert(struct bplus_tree *tree, key_t key, long data)
+void bplus_snapshot_release(struct bplus_snapshot *snap)
 {
-        struct bplus_node *node = node_seek(tree, tree->root);
-        while (node != NULL) {
-				/*到达叶子节点*/
-                if (is_leaf(node)) {
-                        return leaf_insert(tree, node, key, data);
-				/*还未到达叶子节点，继续循环递归查找*/
-                } else {
-                        int i = key_binary_search(node, key);
-                        if (i >= 0) {
-                                node = node_seek(tree, sub(node)[i + 1]);
-                        } else {
-                                i = -i - 1;
-                                node = node_seek(tree, sub(node)[i]);
+        int i;
+        struct bplus_tree *tree = snap->tree;
+
+        pthread_mutex_lock(&tree->snap_lock);
+        list_del(&snap->link);
+        for (i = 0; i < SNAPSHOT_HASH_SIZE; i++) {
+                struct snapshot_page *page = snap->pages[i];
+                while (page != NULL) {
+                        struct snapshot_page *next = page->next;
+                        if (--page->copy->refs == 0) {
+                                struct free_block *block = malloc(sizeof(*block));
+                                assert(block != NULL);
+                                block->offset = page->copy->offset;
+                                list_add_tail(&block->link, &tree->snap_reclaim);
+                                free(page->copy);
                         }
+                        free(page);
+                        page = next;
                 }
         }
+        pthread_mutex_unlock(&tree->snap_lock);
 
-        /*
-		创建新的叶子节点
-		在B+树后面跟随赋值key和data
-		添加key：key(root)[0] = key;
-		添加data：data(root)[0] = data;
-		插入树：tree->root = new_node_append(tree, root);
-		刷新缓冲区：node_flush(tree, root);
-		*/
-        struct bplus_node *root = leaf_new(tree);
-        key(root)[0] = key;
-        data(root)[0] = data;
-        root->children = 1;
-        tree->root = new_node_append(tree, root);
-        tree->level = 1;
-        node_flush(tree, root);
-        return 0;
+        free(snap->buf);
+        free(snap);
+}
+
+/*
+按快照读取节点，区块被覆盖过就读取保存的旧内容
+查找页表和读取时加锁，写线程不能在两者之间覆盖区块
+*/
+static struct bplus_node *snapshot_node_read(struct bplus_snapshot *snap, off_t offset)
+{
+        if (offset == INVALID_OFFSET) {
+                return NULL;
+        }
+
+        struct bplus_tree *tree = snap->tree;
+        pthread_mutex_lock(&tree->snap_lock);
+        struct snapshot_page *page = snapshot_page_find(snap, offset);
+        int len = pread(tree->fd, snap->buf, _block_size, page != NULL ? page->copy->offset : offset);
+        pthread_mutex_unlock(&tree->snap_lock);
+        assert(len == _block_size);
+        return (struct bplus_node *) snap->buf;
 }
 
 /*
-struct bplus_node *l_sib------------------左兄弟
-struct bplus_node *r_sib------------------右兄弟
-struct bplus_node *parent-----------------父节点
-int i-------------------------------------键值在父节点中的位置
+从快照的根节点查找到key所在的叶子节点
 */
-static inline int sibling_select(struct bplus_node *l_sib, struct bplus_node *r_sib, struct bplus_node *parent, int i)
+static struct bplus_node *snapshot_leaf_search(struct bplus_snapshot *snap, key_t key)
 {
-        if (i == -1) {
-                /*没有左兄弟，选择右兄弟合并*/
-                return RIGHT_SIBLING;
-        } else if (i == parent->children - 2) {
-                /*没有右兄弟，选择左兄弟*/
-                return LEFT_SIBLING;
-        } else {
-                /*有左右兄弟，选择孩子更多的节点*/
-                return l_sib->children >= r_sib->children ? LEFT_SIBLING : RIGHT_SIBLING;
+        struct bplus_node *node = snapshot_node_read(snap, snap->root);
+        while (node != NULL && !is_leaf(node)) {
+                int i = key_search(node, key, snap->tree->search_mode, NULL);
+                if (i >= 0) {
+                        node = snapshot_node_read(snap, sub(node)[i + 1]);
+                } else {
+                        i = -i - 1;
+                        node = snapshot_node_read(snap, sub(node)[i]);
+                }
         }
+        return node;
 }
 
 /*
-非叶子节点从左兄弟拿一个值
+在快照中查找
 */
-static void non_leaf_shift_from_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+long bplus_snapshot_get(struct bplus_snapshot *snap, key_t key)
 {
-        memmove(&key(node)[1], &key(node)[0], remove * sizeof(key_t));
-        memmove(&sub(node)[1], &sub(node)[0], (remove + 1) * sizeof(off_t));
-
-        key(node)[0] = key(parent)[parent_key_index];
-        key(parent)[parent_key_index] = key(left)[left->children - 2];
-
-        sub(node)[0] = sub(left)[left->children - 1];
-        sub_node_flush(tree, node, sub(node)[0]);
-
-        left->children--;
+        struct bplus_node *node = snapshot_leaf_search(snap, key);
+        if (node == NULL) {
+                return -1;
+        }
+        int i = key_search(node, key, snap->tree->search_mode, NULL);
+        return i >= 0 ? data(node)[i] : -1;
 }
 
 /*
-非叶子节点合并到左兄弟
+在快照中获取范围，返回key1到key2之间最后一个键值的数据，与bplus_tree_get_range相同
 */
-static void non_leaf_merge_into_left(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+long bplus_snapshot_get_range(struct bplus_snapshot *snap, key_t key1, key_t key2)
 {
-        /*键值下移*/
-        key(left)[left->children - 1] = key(parent)[parent_key_index];
-
-        memmove(&key(left)[left->children], &key(node)[0], remove * sizeof(key_t));
-        memmove(&sub(left)[left->children], &sub(node)[0], (remove + 1) * sizeof(off_t));
+        long start = -1;
+        key_t min = key1 <= key2 ? key1 : key2;
+        key_t max = min == key1 ? key2 : key1;
 
-        memmove(&key(left)[left->children + remove], &key(node)[remove + 1], (node->children - remove - 2) * sizeof(key_t));
-        memmove(&sub(left)[left->children + remove + 1], &sub(node)[remove + 2], (node->children - remove - 2) * sizeof(off_t));
+        struct bplus_node *node = snapshot_leaf_search(snap, min);
+        if (node == NULL) {
+                return -1;
+        }
 
-        int i, j;
-        for (i = left->children, j = 0; j < node->children - 1; i++, j++) {
-                sub_node_flush(tree, left, sub(left)[i]);
+        int i = key_search(node, min, snap->tree->search_mode, NULL);
+        if (i < 0) {
+                i = -i - 1;
+        }
+        while (node != NULL) {
+                if (i >= node->children) {
+                        node = snapshot_node_read(snap, node->next);
+                        i = 0;
+                } else if (key(node)[i] <= max) {
+                        start = data(node)[i++];
+                } else {
+                        break;
+                }
         }
+        return start;
+}
 
-        left->children += node->children - 1;
+/*
+导出文件每次写入的静态叶子个数
+*/
+#define STATIC_WRITE_LEAVES 64
+
+/*
+按中序遍历把有序的分隔键值填入Eytzinger数组，eyt[k]的孩子为eyt[2k]和eyt[2k+1]
+key_t *seps-------------------有序的分隔键值，即每个静态叶子的第一个键值
+long i------------------------下一个要填入的分隔键值
+long k------------------------当前填写的位置，从1开始
+返回--------------------------填完子树后下一个要填入的分隔键值
+*/
+static long eytzinger_build(struct static_sep *eyt, key_t *seps, long m, long i, long k)
+{
+        if (k <= m) {
+                i = eytzinger_build(eyt, seps, m, i, 2 * k);
+                eyt[k].key = seps[i];
+                eyt[k].leaf = i++;
+                i = eytzinger_build(eyt, seps, m, i, 2 * k + 1);
+        }
+        return i;
 }
 
 /*
-非叶子节点从右兄弟拿一个值
+导出只读的静态索引文件
+沿叶子节点链表读取全部数据，写成全满的静态叶子，每个静态叶子STATIC_LEAF_KEYS个键值，键值正好占一个缓存行
+最后写入分隔键值的Eytzinger数组和文件头
+文件结构：文件头|静态叶子0|静态叶子1|...|Eytzinger数组，都按缓存行对齐
+返回--------------------------成功返回导出的键值个数，失败返回-1
 */
-static void non_leaf_shift_from_right(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
+long bplus_tree_export(struct bplus_tree *tree, char *filename)
 {
-        key(node)[node->children - 1] = key(parent)[parent_key_index];
-        key(parent)[parent_key_index] = key(right)[0];
+        struct bplus_static_header header;
+        long cap = 64, m = 0, entries = 0;
+        int n = 0, ok = 1;
 
-        sub(node)[node->children] = sub(right)[0];
-        sub_node_flush(tree, node, sub(node)[node->children]);
-        node->children++;
+        /*静态索引每个键值只有一个数据*/
+        if (tree->flags & (BPLUS_TREE_MULTI | BPLUS_TREE_VLOG)) {
+                return -1;
+        }
 
-        memmove(&key(right)[0], &key(right)[1], (right->children - 2) * sizeof(key_t));
-        memmove(&sub(right)[0], &sub(right)[1], (right->children - 1) * sizeof(off_t));
+        int fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+                return -1;
+        }
 
-        right->children--;
+        key_t *seps = malloc(cap * sizeof(key_t));
+        struct static_leaf *buf = calloc(STATIC_WRITE_LEAVES, sizeof(struct static_leaf));
+        assert(seps != NULL && buf != NULL);
+        off_t offset = sizeof(header);
+
+        struct bplus_node *node = leaf_first(tree);
+
+        /*沿叶子节点链表复制数据，叶子节点可能为空*/
+        while (node != NULL) {
+                int i;
+                for (i = 0; i < node->children; i++) {
+                        struct static_leaf *leaf = &buf[m % STATIC_WRITE_LEAVES];
+                        if (n == 0) {
+                                if (m == cap) {
+                                        cap *= 2;
+                                        seps = realloc(seps, cap * sizeof(key_t));
+                                        assert(seps != NULL);
+                                }
+                                seps[m] = key(node)[i];
+                        }
+                        leaf->key[n] = key(node)[i];
+                        leaf->data[n] = data(node)[i];
+                        entries++;
+                        /*静态叶子写满*/
+                        if (++n == STATIC_LEAF_KEYS) {
+                                n = 0;
+                                if (++m % STATIC_WRITE_LEAVES == 0) {
+                                        ssize_t len = sizeof(*buf) * STATIC_WRITE_LEAVES;
+                                        if (ok && pwrite(fd, buf, len, offset) != len) {
+                                                ok = 0;
+                                        }
+                                        offset += len;
+                                }
+                        }
+                }
+                node = node_seek(tree, node->next);
+        }
+
+        /*最后一个未满的静态叶子，剩余位置填最大键值*/
+        if (n > 0) {
+                struct static_leaf *leaf = &buf[m % STATIC_WRITE_LEAVES];
+                for (; n < STATIC_LEAF_KEYS; n++) {
+                        leaf->key[n] = INT_MAX;
+                        leaf->data[n] = -1;
+                }
+                m++;
+        }
+        if (m % STATIC_WRITE_LEAVES != 0) {
+                ssize_t len = sizeof(*buf) * (m % STATIC_WRITE_LEAVES);
+                if (ok && pwrite(fd, buf, len, offset) != len) {
+                        ok = 0;
+                }
+                offset += len;
+        }
+
+        /*分隔键值的Eytzinger数组，eyt[0]不使用*/
+        struct static_sep *eyt = calloc(m + 1, sizeof(*eyt));
+        assert(eyt != NULL);
+        eytzinger_build(eyt, seps, m, 0, 1);
+        ssize_t len = (m + 1) * sizeof(*eyt);
+        if (ok && pwrite(fd, eyt, len, offset) != len) {
+                ok = 0;
+        }
+
+        /*最后写文件头，文件头完整表示导出成功，写入失败时没有文件头，删除文件*/
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STATIC_MAGIC, sizeof(header.magic));
+        header.entries = entries;
+        header.leaves = m;
+        header.eyt_offset = offset;
+        if (ok && pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+                ok = 0;
+        }
+        close(fd);
+        if (!ok) {
+                unlink(filename);
+        }
+
+        free(eyt);
+        free(buf);
+        free(seps);
+        return ok ? entries : -1;
 }
 
 /*
-非叶子节点合并到右兄弟
+打开导出的静态索引，整个文件映射到内存，之后的查找和扫描不加锁也没有系统调用
+返回--------------------------成功返回静态索引，文件不正确返回NULL
 */
-static void non_leaf_merge_from_right(struct bplus_tree *tree, struct bplus_node *node, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
+struct bplus_static *bplus_static_open(char *filename)
 {
-        key(node)[node->children - 1] = key(parent)[parent_key_index];
-        node->children++;
+        struct stat st;
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct bplus_static_header)) {
+                close(fd);
+                return NULL;
+        }
 
-        memmove(&key(node)[node->children - 1], &key(right)[0], (right->children - 1) * sizeof(key_t));
-        memmove(&sub(node)[node->children - 1], &sub(right)[0], right->children * sizeof(off_t));
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+                return NULL;
+        }
 
-        int i, j;
-        for (i = node->children - 1, j = 0; j < right->children; i++, j++) {
-                sub_node_flush(tree, node, sub(node)[i]);
+        struct bplus_static_header *header = (struct bplus_static_header *) map;
+        if (memcmp(header->magic, STATIC_MAGIC, sizeof(header->magic)) != 0 ||
+            header->eyt_offset + (header->leaves + 1) * (off_t) sizeof(struct static_sep) > st.st_size) {
+                munmap(map, st.st_size);
+                return NULL;
         }
 
-        node->children += right->children - 1;
+        struct bplus_static *index = malloc(sizeof(*index));
+        assert(index != NULL);
+        index->map = map;
+        index->size = st.st_size;
+        index->entries = header->entries;
+        index->leaves = header->leaves;
+        index->leaf = (struct static_leaf *) (map + sizeof(*header));
+        index->eyt = (struct static_sep *) (map + header->eyt_offset);
+        return index;
 }
 
 /*
-非叶子节点的简单删除
+关闭静态索引
 */
-static inline void non_leaf_simple_remove(struct bplus_tree *tree, struct bplus_node *node, int remove)
+void bplus_static_close(struct bplus_static *index)
 {
-        assert(node->children >= 2);
-        memmove(&key(node)[remove], &key(node)[remove + 1], (node->children - remove - 2) * sizeof(key_t));
-        memmove(&sub(node)[remove + 1], &sub(node)[remove + 2], (node->children - remove - 2) * sizeof(off_t));
-        node->children--;
+        munmap(index->map, index->size);
+        free(index);
 }
 
 /*
-非叶子节点的删除操作
-叶子节点删除操作后，更新非叶子节点，非叶子节点的键值也可能被删除，非叶子节点也可能合并
-struct bplus_tree *tree---------------------B+树信息结构体
-struct bplus_node *node---------------------要执行删除操作的节点
-int remove----------------------------------要删除的键值位置
+在静态索引中查找第一个大于等于key的位置
+先在Eytzinger数组中找到最后一个第一个键值不大于key的静态叶子，预取下几层用到的缓存行
+再在静态叶子内二分查找
+返回--------------------------位置，即静态叶子序号*STATIC_LEAF_KEYS+叶子内位置，不存在返回entries
 */
-static void non_leaf_remove(struct bplus_tree *tree, struct bplus_node *node, int remove)
+static long static_lower_bound(struct bplus_static *index, key_t key)
 {
-		/*不存在父节点，要执行删除操作的节点是根节点*/
-        if (node->parent == INVALID_OFFSET) {
-                /*只有两个键值*/
-                if (node->children == 2) {
-                        /*用第一个子节点替换旧根节点*/
-                        struct bplus_node *root = node_fetch(tree, sub(node)[0]);
-                        root->parent = INVALID_OFFSET;
-                        tree->root = root->self;
-                        tree->level--;
-                        node_delete(tree, node, NULL, NULL);
-                        node_flush(tree, root);
-				/*键值大于2，将remove后的数据前移*/
-                } else {
-                        non_leaf_simple_remove(tree, node, remove);
-                        node_flush(tree, node);
-                }
-		/*存在父节点，且非叶子节点内含数据小于一半，也要进行合并操作*/
-        } else if (node->children <= (_max_order + 1) / 2) {
-                struct bplus_node *l_sib = node_fetch(tree, node->prev);
-                struct bplus_node *r_sib = node_fetch(tree, node->next);
-                struct bplus_node *parent = node_fetch(tree, node->parent);
+        long k = 1, m = index->leaves;
 
-                int i = parent_key_index(parent, key(node)[0]);
+        if (m == 0) {
+                return 0;
+        }
 
-                /*选择左兄弟合并*/
-                if (sibling_select(l_sib, r_sib, parent, i)  == LEFT_SIBLING) {
-						/*左兄弟节点内数据过半，无法合并，就拿一个数据过来*/
-                        if (l_sib->children > (_max_order + 1) / 2) {
-								/*左兄弟数据未过半，两两合并*/
-                                non_leaf_shift_from_left(tree, node, l_sib, parent, i, remove);
-                                node_flush(tree, node);
-                                node_flush(tree, l_sib);
-                                node_flush(tree, r_sib);
-                                node_flush(tree, parent);
-						/*左兄弟数据未过半，两两合并*/
-                        } else {
-                                non_leaf_merge_into_left(tree, node, l_sib, parent, i, remove);
-                                node_delete(tree, node, l_sib, r_sib);
-                                non_leaf_remove(tree, parent, i);
-                        }
-				/*选择右兄弟合并*/
+        while (k <= m) {
+                __builtin_prefetch(index->eyt + k * STATIC_SEPS_PER_LINE);
+                k = 2 * k + (index->eyt[k].key <= key);
+        }
+        /*去掉最后连续的右转，得到第一个大于key的分隔键值*/
+        k >>= __builtin_ffsl(~k);
+        long leaf = (k != 0 ? index->eyt[k].leaf : m) - 1;
+        if (leaf < 0) {
+                return 0;
+        }
+
+        key_t *keys = index->leaf[leaf].key;
+        int lo = 0, hi = STATIC_LEAF_KEYS;
+        while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (keys[mid] < key) {
+                        lo = mid + 1;
                 } else {
-                        /*在与兄弟节点合并时首先删除，以防溢出*/
-                        non_leaf_simple_remove(tree, node, remove);
-						
-						/*右兄弟节点内数据过半，无法合并，就拿一个数据过来*/
-                        if (r_sib->children > (_max_order + 1) / 2) {
-                                non_leaf_shift_from_right(tree, node, r_sib, parent, i + 1);
-                                node_flush(tree, node);
-                                node_flush(tree, l_sib);
-                                node_flush(tree, r_sib);
-                                node_flush(tree, parent);
-						/*右兄弟数据未过半，两两合并*/
-                        } else {
-                                non_leaf_merge_from_right(tree, node, r_sib, parent, i + 1);
-                                struct bplus_node *rr_sib = node_fetch(tree, r_sib->next);
-                                node_delete(tree, r_sib, node, rr_sib);
-                                node_flush(tree, l_sib);
-                                non_leaf_remove(tree, parent, i + 1);
-                        }
+                        hi = mid;
                 }
-		/*存在父节点，且非叶子节点内含数据大于一半，不需要进行合并操作*/
-        } else {
-                non_leaf_simple_remove(tree, node, remove);
-                node_flush(tree, node);
         }
+        long pos = leaf * STATIC_LEAF_KEYS + lo;
+        return pos < index->entries ? pos : index->entries;
 }
 
 /*
-从左兄弟拿一个数据，来保持平衡
-struct bplus_tree *tree------------------B+树信息结构体
-struct bplus_node *leaf------------------要执行删除操作和合并操作的叶子节点
-struct bplus_node *left------------------左兄弟
-struct bplus_node *parent----------------父节点
-int parent_key_index---------------------leaf在父节点的位置
-int remove-------------------------------删除的数据在leaf的位置
+在静态索引中查找
 */
-static void leaf_shift_from_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, struct bplus_node *parent, int parent_key_index, int remove)
+long bplus_static_get(struct bplus_static *index, key_t key)
 {
-        /*腾出第一个位置*/
-        memmove(&key(leaf)[1], &key(leaf)[0], remove * sizeof(key_t));
-        memmove(&data(leaf)[1], &data(leaf)[0], remove * sizeof(off_t));
-
-        /*从左兄弟拿一个数据*/
-        key(leaf)[0] = key(left)[left->children - 1];
-        data(leaf)[0] = data(left)[left->children - 1];
-        left->children--;
-
-        /*更新父节点的键值*/
-        key(parent)[parent_key_index] = key(leaf)[0];
+        long pos = static_lower_bound(index, key);
+        if (pos < index->entries) {
+                struct static_leaf *leaf = &index->leaf[pos / STATIC_LEAF_KEYS];
+                if (leaf->key[pos % STATIC_LEAF_KEYS] == key) {
+                        return leaf->data[pos % STATIC_LEAF_KEYS];
+                }
+        }
+        return -1;
 }
 
 /*
-左兄弟数据未过半，两两合并
+在静态索引中升序扫描key1到key2之间(包含两端)的键值和数据
+key_t *keys-------------------返回的键值，可以为NULL
+long *data--------------------返回的数据，可以为NULL
+int max-----------------------最多返回的个数
+返回--------------------------返回的个数
 */
-static void leaf_merge_into_left(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *left, int parent_key_index, int remove)
+int bplus_static_scan(struct bplus_static *index, key_t key1, key_t key2, key_t *keys, long *data, int max)
 {
-        /*将key和data从leaf复制到left，不包括被删除的数据*/
-        memmove(&key(left)[left->children], &key(leaf)[0], remove * sizeof(key_t));
-        memmove(&data(left)[left->children], &data(leaf)[0], remove * sizeof(off_t));
-        memmove(&key(left)[left->children + remove], &key(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(key_t));
-        memmove(&data(left)[left->children + remove], &data(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(off_t));
-        left->children += leaf->children - 1;
+        int n = 0;
+        key_t min = key1 <= key2 ? key1 : key2;
+        key_t max_key = min == key1 ? key2 : key1;
+        long pos = static_lower_bound(index, min);
+
+        for (; pos < index->entries && n < max; pos++) {
+                struct static_leaf *leaf = &index->leaf[pos / STATIC_LEAF_KEYS];
+                int i = pos % STATIC_LEAF_KEYS;
+                if (leaf->key[i] > max_key) {
+                        break;
+                }
+                if (keys != NULL) {
+                        keys[n] = leaf->key[i];
+                }
+                if (data != NULL) {
+                        data[n] = leaf->data[i];
+                }
+                n++;
+        }
+        return n;
 }
 
 /*
-从左兄弟拿一个数据，来保持平衡
-struct bplus_tree *tree------------------B+树信息结构体
-struct bplus_node *leaf------------------要执行删除操作和合并操作的叶子节点
-struct bplus_node *right-----------------右兄弟
-struct bplus_node *parent----------------父节点
-int parent_key_index---------------------leaf在父节点的位置
-int remove-------------------------------删除的数据在leaf的位置
+键值所在的分区
+范围分区：最小键值不大于key的最后一个分区
+哈希分区：哈希值的高32位取模，低位留给分区内的热点缓存分片
 */
-static void leaf_shift_from_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right, struct bplus_node *parent, int parent_key_index)
-{
-        /*leaf最后一个位置放right第一个数据*/
-        key(leaf)[leaf->children] = key(right)[0];
-        data(leaf)[leaf->children] = data(right)[0];
-        leaf->children++;
-
-        /*right左移*/
-        memmove(&key(right)[0], &key(right)[1], (right->children - 1) * sizeof(key_t));
-        memmove(&data(right)[0], &data(right)[1], (right->children - 1) * sizeof(off_t));
-        right->children--;
+static int shard_route(struct bplus_shards *shards, key_t key)
+{
+        if (shards->mode == BPLUS_SHARD_HASH) {
+                return (key_hash(key) >> 32) % shards->count;
+        }
 
-        /*更新父节点的键值*/
-        key(parent)[parent_key_index] = key(right)[0];
+        int low = 0, high = shards->count - 1;
+        while (low < high) {
+                int mid = low + (high - low + 1) / 2;
+                if (shards->bounds[mid] <= key) {
+                        low = mid;
+                } else {
+                        high = mid - 1;
+                }
+        }
+        return low;
 }
 
 /*
-左兄弟数据未过半，两两合并
+保存分区表，先写临时文件再改名，分区表总是完整的
+第一行为分区方式、分区个数和区块大小，之后每行为一个分区的最小键值和键值个数
 */
-static inline void leaf_merge_from_right(struct bplus_tree *tree, struct bplus_node *leaf, struct bplus_node *right)
+static void shards_store(struct bplus_shards *shards)
 {
-        memmove(&key(leaf)[leaf->children], &key(right)[0], right->children * sizeof(key_t));
-        memmove(&data(leaf)[leaf->children], &data(right)[0], right->children * sizeof(off_t));
-        leaf->children += right->children;
+        char name[1040], tmp[1040];
+        int i;
+
+        snprintf(name, sizeof(name), "%s.shards", shards->filename);
+        snprintf(tmp, sizeof(tmp), "%s.shards.tmp", shards->filename);
+        FILE *fp = fopen(tmp, "w");
+        if (fp == NULL) {
+                return;
+        }
+        fprintf(fp, "%d %d %d\n", shards->mode, shards->count, shards->block_size);
+        for (i = 0; i < shards->count; i++) {
+                fprintf(fp, "%d %ld\n", shards->bounds[i], shards->keys[i]);
+        }
+        if (fclose(fp) == 0) {
+                rename(tmp, name);
+        }
 }
 
 /*
-叶子节点的简单删除操作
+释放分区的B+树占用的内存，关闭已打开的分区
 */
-static inline void leaf_simple_remove(struct bplus_tree *tree, struct bplus_node *leaf, int remove)
+static void shards_free(struct bplus_shards *shards)
 {
-		/*key和data左移覆盖被删除的key和data*/
-        memmove(&key(leaf)[remove], &key(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(key_t));
-        memmove(&data(leaf)[remove], &data(leaf)[remove + 1], (leaf->children - remove - 1) * sizeof(off_t));
-        leaf->children--;
+        int i;
+        for (i = 0; i < shards->count; i++) {
+                if (shards->trees[i] != NULL) {
+                        bplus_tree_deinit(shards->trees[i]);
+                }
+        }
+        free(shards->trees);
+        free(shards->bounds);
+        free(shards->keys);
+        free(shards->locks);
+        free(shards);
 }
 
 /*
-叶子节点的删除操作
-struct bplus_tree *tree-----------------B+树信息结构体
-struct bplus_node *leaf-----------------要执行删除操作的叶子节点
-key_t key-------------------------------要删除的键值
+打开或创建分区的B+树
+<filename>.shards存在时使用保存的分区方式、个数和边界，忽略count和mode
+新建的范围分区平分整个键值空间，之后由bplus_shards_rebalance按键值个数调整
+int count---------------------分区个数，1到SHARD_MAX
+int mode----------------------BPLUS_SHARD_RANGE或BPLUS_SHARD_HASH
+返回--------------------------分区的B+树，出错返回NULL
 */
-static int leaf_remove(struct bplus_tree *tree, struct bplus_node *leaf, key_t key)
+struct bplus_shards *bplus_shards_open(char *filename, int block_size, int count, int mode)
 {
-        int remove = key_binary_search(leaf, key);
-		/*要删除的键值不存在*/
-        if (remove < 0) {
-                return -1;
+        char name[1040];
+        int i, ok = 1;
+
+        /*分区的文件名要加上.shards或分区序号*/
+        if (strlen(filename) >= 1000) {
+                fprintf(stderr, "Index file name too long!\n");
+                return NULL;
         }
 
-        /*节点所在的缓存位置*/
-        int i = ((char *) leaf - tree->caches) / _block_size;
-        tree->used[i] = 1;
-		
-		/*父节点非法，即不存在父节点，要进行删除操作的叶子节点是根节点*/
-        if (leaf->parent == INVALID_OFFSET) {
-                /*节点内只有1个数据*/
-                if (leaf->children == 1) {
-                        /* delete the only last node */
-                        assert(key == key(leaf)[0]);
-                        tree->root = INVALID_OFFSET;
-                        tree->level = 0;
-						/*删除节点*/
-                        node_delete(tree, leaf, NULL, NULL);
-				/*节点内有多个数据*/
-                } else {
-                        leaf_simple_remove(tree, leaf, remove);
-                        node_flush(tree, leaf);
+        snprintf(name, sizeof(name), "%s.shards", filename);
+        FILE *fp = fopen(name, "r");
+        if (fp != NULL && fscanf(fp, "%d %d %d", &mode, &count, &block_size) != 3) {
+                ok = 0;
+        }
+        if (!ok || count < 1 || count > SHARD_MAX || (mode != BPLUS_SHARD_RANGE && mode != BPLUS_SHARD_HASH)) {
+                fprintf(stderr, "Invalid shard table!\n");
+                if (fp != NULL) {
+                        fclose(fp);
                 }
-		/*有父节点，删除后节点内数据过少，要进行合并操作*/
-        } else if (leaf->children <= (_max_entries + 1) / 2) {
-                struct bplus_node *l_sib = node_fetch(tree, leaf->prev);
-                struct bplus_node *r_sib = node_fetch(tree, leaf->next);
-                struct bplus_node *parent = node_fetch(tree, leaf->parent);
-
-                i = parent_key_index(parent, key(leaf)[0]);
+                return NULL;
+        }
 
-                /*选择左兄弟合并*/
-                if (sibling_select(l_sib, r_sib, parent, i) == LEFT_SIBLING) {
-						/*左兄弟节点内数据过半，无法合并，就拿一个数据过来*/
-                        if (l_sib->children > (_max_entries + 1) / 2) {
-                                leaf_shift_from_left(tree, leaf, l_sib, parent, i, remove);
-                                node_flush(tree, leaf);
-                                node_flush(tree, l_sib);
-                                node_flush(tree, r_sib);
-                                node_flush(tree, parent);
-						/*左兄弟数据未过半，合并*/
-                        } else {
-                                leaf_merge_into_left(tree, leaf, l_sib, i, remove);
-                                /*删除无意义的leaf*/
-                                node_delete(tree, leaf, l_sib, r_sib);
-                                /*更新父节点*/
-                                non_leaf_remove(tree, parent, i);
+        struct bplus_shards *shards = calloc(1, sizeof(*shards));
+        assert(shards != NULL);
+        strcpy(shards->filename, filename);
+        shards->block_size = block_size;
+        shards->mode = mode;
+        shards->count = count;
+        shards->trees = calloc(count, sizeof(struct bplus_tree *));
+        shards->bounds = malloc(count * sizeof(key_t));
+        shards->keys = calloc(count, sizeof(long));
+        shards->locks = malloc(count * sizeof(pthread_mutex_t));
+        assert(shards->trees != NULL && shards->bounds != NULL && shards->keys != NULL && shards->locks != NULL);
+
+        for (i = 0; i < count; i++) {
+                if (fp != NULL) {
+                        /*边界必须从INT_MIN开始并且递增*/
+                        if (fscanf(fp, "%d %ld", &shards->bounds[i], &shards->keys[i]) != 2 ||
+                            (i == 0 && shards->bounds[i] != INT_MIN) || (i > 0 && shards->bounds[i] < shards->bounds[i - 1])) {
+                                ok = 0;
                         }
-				/*选择右兄弟合并*/
                 } else {
-                        leaf_simple_remove(tree, leaf, remove);
-						
-						/*右兄弟节点内数据过半，无法合并，就拿一个数据过来*/
-                        if (r_sib->children > (_max_entries + 1) / 2) {
-                                leaf_shift_from_right(tree, leaf, r_sib, parent, i + 1);
-                                /* flush leaves */
-                                node_flush(tree, leaf);
-                                node_flush(tree, l_sib);
-                                node_flush(tree, r_sib);
-                                node_flush(tree, parent);
-						/*右兄弟数据未过半，合并*/
-                        } else {
-                                leaf_merge_from_right(tree, leaf, r_sib);
-                                /*删除无意义的leaf*/
-                                struct bplus_node *rr_sib = node_fetch(tree, r_sib->next);
-                                node_delete(tree, r_sib, leaf, rr_sib);
-                                node_flush(tree, l_sib);
-                                /*更新父节点*/
-                                non_leaf_remove(tree, parent, i + 1);
-                        }
+                        shards->bounds[i] = (key_t) ((long) INT_MIN + ((long) UINT_MAX + 1) / count * i);
                 }
-		/*有父节点，但删除后，节点内数据大于一半，不进行合并*/
-        } else {
-                leaf_simple_remove(tree, leaf, remove);
-                node_flush(tree, leaf);
+        }
+        if (fp != NULL) {
+                fclose(fp);
+        }
+        if (!ok) {
+                fprintf(stderr, "Invalid shard table!\n");
+                shards_free(shards);
+                return NULL;
         }
 
-        return 0;
+        for (i = 0; i < count; i++) {
+                snprintf(name, sizeof(name), "%s.%d", filename, i);
+                shards->trees[i] = bplus_tree_init(name, block_size);
+                if (shards->trees[i] == NULL) {
+                        shards_free(shards);
+                        return NULL;
+                }
+                pthread_mutex_init(&shards->locks[i], NULL);
+        }
+        pthread_rwlock_init(&shards->route, NULL);
+        shards_store(shards);
+        return shards;
 }
 
 /*
-删除节点
+关闭分区的B+树，保存分区表
 */
-static int bplus_tree_delete(struct bplus_tree *tree, key_t key)
+void bplus_shards_close(struct bplus_shards *shards)
 {
-        struct bplus_node *node = node_seek(tree, tree->root);
-        while (node != NULL) {
-				/*叶子节点，直接进行删除操作*/
-                if (is_leaf(node)) {
-                        return leaf_remove(tree, node, key);
-				/*非叶子节点，继续循环递归查找*/
-                } else {
-                        int i = key_binary_search(node, key);
-                        if (i >= 0) {
-                                node = node_seek(tree, sub(node)[i + 1]);
-                        } else {
-                                i = -i - 1;
-                                node = node_seek(tree, sub(node)[i]);
-                        }
-                }
+        int i;
+        shards_store(shards);
+        for (i = 0; i < shards->count; i++) {
+                pthread_mutex_destroy(&shards->locks[i]);
         }
-        return -1;
+        pthread_rwlock_destroy(&shards->route);
+        shards_free(shards);
 }
 
 /*
-查找结点的入口
+在键值所在的分区中查找，不同分区的查找可以在多个线程中同时进行
 */
-long bplus_tree_get(struct bplus_tree *tree, key_t key)
+long bplus_shards_get(struct bplus_shards *shards, key_t key)
 {
-        return bplus_tree_search(tree, key);
+        pthread_rwlock_rdlock(&shards->route);
+        int i = shard_route(shards, key);
+        pthread_mutex_lock(&shards->locks[i]);
+        long data = bplus_tree_get(shards->trees[i], key);
+        pthread_mutex_unlock(&shards->locks[i]);
+        pthread_rwlock_unlock(&shards->route);
+        return data;
 }
 
 /*
-处理节点入口
-插入节点
-删除节点
+在键值所在的分区中插入和删除，data为0时删除
 */
-int bplus_tree_put(struct bplus_tree *tree, key_t key, long data)
+int bplus_shards_put(struct bplus_shards *shards, key_t key, long data)
 {
-        if (data) {
-                return bplus_tree_insert(tree, key, data);
+        pthread_rwlock_rdlock(&shards->route);
+        int i = shard_route(shards, key);
+        pthread_mutex_lock(&shards->locks[i]);
+        int ret = bplus_tree_put(shards->trees[i], key, data);
+        if (ret == 0) {
+                shards->keys[i] += data ? 1 : -1;
+        }
+        pthread_mutex_unlock(&shards->locks[i]);
+        pthread_rwlock_unlock(&shards->route);
+        return ret;
+}
+
+/*
+从分区中读取下一批键值，读取时只占用这个分区的锁
+*/
+static void shard_fill(struct bplus_shards *shards, int i, struct shard_cursor *cur, key_t max)
+{
+        pthread_mutex_lock(&shards->locks[i]);
+        cur->n = range_scan_asc(shards->trees[i], cur->next, max, cur->keys, cur->data, SHARD_SCAN_CHUNK);
+        pthread_mutex_unlock(&shards->locks[i]);
+        cur->pos = 0;
+
+        /*读到的个数不足或者已经读到max时分区读完*/
+        if (cur->n < SHARD_SCAN_CHUNK || cur->keys[cur->n - 1] >= max) {
+                cur->done = 1;
         } else {
-                return bplus_tree_delete(tree, key);
+                cur->next = cur->keys[cur->n - 1] + 1;
         }
 }
 
 /*
-获取范围
+在全部分区中范围查找，从小到大返回key1到key2之间(包含两端)的键值和数据
+每个分区每次读取SHARD_SCAN_CHUNK个，多个分区的结果按键值归并
+范围分区的分区互不相交，按顺序读完一个分区再读下一个，只读取和范围相交的分区
+key_t *keys-------------------返回的键值，可以为NULL
+long *data--------------------返回的数据，可以为NULL
+int max-----------------------最多返回的个数
+返回--------------------------返回的个数
 */
-long bplus_tree_get_range(struct bplus_tree *tree, key_t key1, key_t key2)
+int bplus_shards_get_range(struct bplus_shards *shards, key_t key1, key_t key2, key_t *keys, long *data, int max)
 {
-        long start = -1;
         key_t min = key1 <= key2 ? key1 : key2;
-        key_t max = min == key1 ? key2 : key1;
+        key_t max_key = min == key1 ? key2 : key1;
+        int i, n = 0, first = 0, last = shards->count - 1;
 
-        struct bplus_node *node = node_seek(tree, tree->root);
-        while (node != NULL) {
-                int i = key_binary_search(node, min);
-                if (is_leaf(node)) {
-                        if (i < 0) {
-                                i = -i - 1;
-                                if (i >= node->children) {
-                                        node = node_seek(tree, node->next);
-                                }
+        struct shard_cursor *cur = malloc(shards->count * sizeof(*cur));
+        assert(cur != NULL);
+
+        /*扫描期间分区边界不能改变*/
+        pthread_rwlock_rdlock(&shards->route);
+        if (shards->mode == BPLUS_SHARD_RANGE) {
+                first = shard_route(shards, min);
+                last = shard_route(shards, max_key);
+        }
+        for (i = first; i <= last; i++) {
+                cur[i].n = 0;
+                cur[i].pos = 0;
+                cur[i].next = min;
+                cur[i].done = 0;
+        }
+
+        while (n < max) {
+                int best = -1;
+                for (i = first; i <= last; i++) {
+                        struct shard_cursor *c = &cur[i];
+                        if (c->pos == c->n && !c->done) {
+                                shard_fill(shards, i, c, max_key);
                         }
-                        while (node != NULL && key(node)[i] <= max) {
-                                start = data(node)[i];
-                                if (++i >= node->children) {
-                                        node = node_seek(tree, node->next);
-                                        i = 0;
+                        if (c->pos < c->n && (best < 0 || c->keys[c->pos] < cur[best].keys[cur[best].pos])) {
+                                best = i;
+                                /*范围分区中第一个还有数据的分区的键值最小*/
+                                if (shards->mode == BPLUS_SHARD_RANGE) {
+                                        break;
                                 }
                         }
+                }
+                if (best < 0) {
                         break;
-                } else {
-                        if (i >= 0) {
-                                node = node_seek(tree, sub(node)[i + 1]);
-                        } else  {
-                                i = -i - 1;
-                                node = node_seek(tree, sub(node)[i]);
-                        }
                 }
+                if (keys != NULL) {
+                        keys[n] = cur[best].keys[cur[best].pos];
+                }
+                if (data != NULL) {
+                        data[n] = cur[best].data[cur[best].pos];
+                }
+                cur[best].pos++;
+                n++;
         }
+        pthread_rwlock_unlock(&shards->route);
 
-        return start;
+        free(cur);
+        return n;
+}
+
+/*
+调整分区i和i+1之间的边界，使边界左边的键值个数接近平均分配的个数，每次最多移动SHARD_MOVE_BATCH个键值
+先插入到目标分区，再从原分区范围删除，最后修改边界
+返回--------------------------移动的键值个数，不需要调整时返回0
+*/
+static int shard_move(struct bplus_shards *shards, int i, key_t *keys, long *data)
+{
+        struct bplus_tree *left = shards->trees[i], *right = shards->trees[i + 1];
+        long total = 0, prefix = 0, diff, slack;
+        int k, n;
+
+        for (k = 0; k < shards->count; k++) {
+                total += shards->keys[k];
+                if (k <= i) {
+                        prefix += shards->keys[k];
+                }
+        }
+        diff = prefix - total * (i + 1) / shards->count;
+        slack = total / shards->count / SHARD_TOLERANCE;
+        if (slack < SHARD_MIN_MOVE) {
+                slack = SHARD_MIN_MOVE;
+        }
+        if (diff <= slack && -diff <= slack) {
+                return 0;
+        }
+        n = diff > 0 ? diff : -diff;
+        n = n < SHARD_MOVE_BATCH ? n : SHARD_MOVE_BATCH;
+
+        if (diff > 0) {
+                /*左边分区最大的n个键值移到右边，边界降到其中最小的键值*/
+                n = range_scan_desc(left, INT_MIN, INT_MAX, keys, data, n);
+                if (n == 0) {
+                        return 0;
+                }
+                for (k = 0; k < n; k++) {
+                        bplus_tree_put(right, keys[k], data[k]);
+                }
+                bplus_tree_delete_range(left, keys[n - 1], keys[0]);
+                shards->bounds[i + 1] = keys[n - 1];
+                shards->keys[i] -= n;
+                shards->keys[i + 1] += n;
+        } else {
+                /*右边分区最小的n个键值移到左边，边界升到其中最大的键值之后，INT_MAX不能移动*/
+                n = range_scan_asc(right, INT_MIN, INT_MAX - 1, keys, data, n);
+                if (n == 0) {
+                        return 0;
+                }
+                for (k = 0; k < n; k++) {
+                        bplus_tree_put(left, keys[k], data[k]);
+                }
+                bplus_tree_delete_range(right, keys[0], keys[n - 1]);
+                shards->bounds[i + 1] = keys[n - 1] + 1;
+                shards->keys[i] += n;
+                shards->keys[i + 1] -= n;
+        }
+        return n;
+}
+
+/*
+在线调整范围分区的边界，使各个分区的键值个数接近
+每次只移动一批键值，移动时独占分区表，每批之间释放，前台的读写可以继续
+反复扫描相邻分区，直到不再需要移动
+返回--------------------------移动的键值个数，哈希分区返回0
+*/
+long bplus_shards_rebalance(struct bplus_shards *shards)
+{
+        long moved = 0, pass;
+        int i, n;
+
+        if (shards->mode != BPLUS_SHARD_RANGE) {
+                return 0;
+        }
+
+        key_t *keys = malloc(SHARD_MOVE_BATCH * sizeof(key_t));
+        long *data = malloc(SHARD_MOVE_BATCH * sizeof(long));
+        assert(keys != NULL && data != NULL);
+
+        do {
+                pass = 0;
+                for (i = 0; i + 1 < shards->count; i++) {
+                        do {
+                                pthread_rwlock_wrlock(&shards->route);
+                                n = shard_move(shards, i, keys, data);
+                                if (n > 0) {
+                                        shards_store(shards);
+                                }
+                                pthread_rwlock_unlock(&shards->route);
+                                pass += n;
+                        } while (n > 0);
+                }
+                moved += pass;
+        } while (pass > 0);
+
+        free(keys);
+        free(data);
+        return moved;
 }
 
 /*
@@ -1347,6 +6571,16 @@ int bplus_open(char *filename)
         return open(filename, O_CREAT | O_RDWR, 0644);
 }
 
+/*
+以O_DIRECT方式打开B+树，读写不经过页缓存
+读写的缓冲区、偏移量和长度都必须对齐
+返回fd
+*/
+int bplus_open_direct(char *filename)
+{
+        return open(filename, O_CREAT | O_RDWR | O_DIRECT, 0644);
+}
+
 /*
 关闭B+树
 */
@@ -1417,6 +6651,31 @@ int block_size----------文件大小
 返回--------------------B+树头节点结构体指针
 */
 struct bplus_tree *bplus_tree_init(char *filename, int block_size)
+{
+        return bplus_tree_init_flags(filename, block_size, 0);
+}
+
+/*
+非叶子节点的最大分支个数
+BPLUS_TREE_COUNTS模式下每个分支多保存一个long类型的计数
+*/
+static int non_leaf_order(int block_size, int flags)
+{
+        int size = sizeof(key_t) + sizeof(off_t);
+        if (flags & BPLUS_TREE_COUNTS) {
+                size += sizeof(long);
+        }
+        return (block_size - sizeof(struct bplus_node)) / size;
+}
+
+/*
+B+树初始化，新建.index时设置可选功能
+.index已存在时使用.boot中保存的可选功能，忽略flags中的可选功能
+BPLUS_TREE_DIRECT是打开方式，每次打开时设置，不保存
+同一进程内同时打开的B+树必须有相同的区块大小和非叶子节点的阶数，否则返回NULL
+int flags---------------可选功能，BPLUS_TREE_COUNTS等，以及打开方式BPLUS_TREE_DIRECT
+*/
+struct bplus_tree *bplus_tree_init_flags(char *filename, int block_size, int flags)
 {
         int i;
         struct bplus_node node;
@@ -1439,12 +6698,14 @@ struct bplus_tree *bplus_tree_init(char *filename, int block_size)
                 return NULL;
         }
 
-        _block_size = block_size;
-        _max_order = (block_size - sizeof(node)) / (sizeof(key_t) + sizeof(off_t));
-        _max_entries = (block_size - sizeof(node)) / (sizeof(key_t) + sizeof(long));
-        
+        /*多值模式和值日志模式都使用叶子节点中的数据保存编码，不能同时使用*/
+        if ((flags & BPLUS_TREE_MULTI) && (flags & BPLUS_TREE_VLOG)) {
+                fprintf(stderr, "Multimap and value log cannot be used together!\n");
+                return NULL;
+        }
+
 		/*文件容量太小*/
-		if (_max_order <= 2) {
+		if (non_leaf_order(block_size, flags) <= 2) {
                 fprintf(stderr, "block size is too small for one node!\n");
                 return NULL;
         }
@@ -1454,6 +6715,12 @@ struct bplus_tree *bplus_tree_init(char *filename, int block_size)
         assert(tree != NULL);
         list_init(&tree->free_blocks);
         strcpy(tree->filename, filename);
+        tree->tail = INVALID_OFFSET;
+        tree->lazy_threshold = -1;
+        list_init(&tree->lazy_leaves);
+        pthread_mutex_init(&tree->snap_lock, NULL);
+        list_init(&tree->snapshots);
+        list_init(&tree->snap_reclaim);
 
         /*
 		加载boot文件，可读可写
@@ -1464,10 +6731,14 @@ struct bplus_tree *bplus_tree_init(char *filename, int block_size)
 		block_size----------分配的空间大小
 		file_size-----------实际空间大小
 		*/
+        int size;
         int fd = open(strcat(tree->filename, ".boot"), O_RDWR, 0644);
         if (fd >= 0) {
                 tree->root = offset_load(fd);
-                _block_size = offset_load(fd);
+                /*低32位为区块大小，高32位为可选功能*/
+                off_t config = offset_load(fd);
+                size = config & 0xffffffff;
+                tree->flags = (config >> 32) & ~BPLUS_TREE_DIRECT;
                 tree->file_size = offset_load(fd);
 				
                 /*加载freeblocks空闲数据块*/
@@ -1480,49 +6751,194 @@ struct bplus_tree *bplus_tree_init(char *filename, int block_size)
                 close(fd);
         } else {
                 tree->root = INVALID_OFFSET;
-                _block_size = block_size;
+                size = block_size;
+                tree->flags = flags & ~BPLUS_TREE_DIRECT;
                 tree->file_size = 0;
         }
 
+        /*
+        节点布局由区块大小和可选功能决定，保存在全局变量中
+        已经有打开的B+树时，布局不同的B+树不能打开，否则会改变已打开的B+树的节点布局
+        */
+        if (_open_trees > 0 && (size != _block_size || non_leaf_order(size, tree->flags) != _max_order)) {
+                fprintf(stderr, "node layout differs from the trees already open!\n");
+                struct list_head *pos, *n;
+                list_for_each_safe(pos, n, &tree->free_blocks) {
+                        list_del(pos);
+                        free(list_entry(pos, struct free_block, link));
+                }
+                pthread_mutex_destroy(&tree->snap_lock);
+                free(tree);
+                return NULL;
+        }
+        _open_trees++;
+
         /*设置节点内关键字和数据最大个数*/
-        _max_order = (_block_size - sizeof(node)) / (sizeof(key_t) + sizeof(off_t));
+        _block_size = size;
+        _max_order = non_leaf_order(_block_size, tree->flags);
         _max_entries = (_block_size - sizeof(node)) / (sizeof(key_t) + sizeof(long));
         printf("config node order:%d and leaf entries:%d and _block_size:%d\n", _max_order, _max_entries,_block_size);
 
-        /*申请和初始化节点缓存*/
-        tree->caches = malloc(_block_size * MIN_CACHE_NUM);
+        /*
+        O_DIRECT模式，节点的偏移量都是_block_size的整数倍，只需要区块不小于扇区并且缓存对齐
+        区块太小或者文件系统不支持O_DIRECT时，使用普通的读写方式
+        */
+        if (flags & BPLUS_TREE_DIRECT) {
+                if (_block_size < DIRECT_IO_MIN_BLOCK) {
+                        fprintf(stderr, "block size is too small for O_DIRECT, using buffered I/O!\n");
+                } else if ((tree->fd = bplus_open_direct(filename)) < 0) {
+                        fprintf(stderr, "O_DIRECT is not supported, using buffered I/O!\n");
+                } else {
+                        tree->flags |= BPLUS_TREE_DIRECT;
+                }
+        }
+
+        /*申请和初始化节点缓存，O_DIRECT模式需要对齐*/
+        if (tree->flags & BPLUS_TREE_DIRECT) {
+                int ret = posix_memalign((void **) &tree->caches, DIRECT_IO_ALIGN, _block_size * MIN_CACHE_NUM);
+                assert(ret == 0);
+        } else {
+                tree->caches = malloc(_block_size * MIN_CACHE_NUM);
 
-        /*打开index文件，首次运行不存在，创建index文件=*/
-        tree->fd = bplus_open(filename);
+                /*打开index文件，首次运行不存在，创建index文件=*/
+                tree->fd = bplus_open(filename);
+        }
         assert(tree->fd >= 0);
+
+        /*已分配的空间，上次关闭时已截断到file_size*/
+        struct stat st;
+        int ret = fstat(tree->fd, &st);
+        assert(ret == 0);
+        tree->alloc_size = st.st_size > tree->file_size ? st.st_size : tree->file_size;
+        tree->extent = PREALLOC_MIN_BLOCKS * _block_size;
+
+        /*多值模式读写溢出页的缓冲区，两个区块：第一页和当前页*/
+        if (tree->flags & BPLUS_TREE_MULTI) {
+                ret = posix_memalign((void **) &tree->post_buf, DIRECT_IO_ALIGN, _block_size * 2);
+                assert(ret == 0);
+        }
+
+        /*值日志模式打开值日志，新的值追加到末尾*/
+        tree->vlog_fd = -1;
+        if (tree->flags & BPLUS_TREE_VLOG) {
+                snprintf(tree->vlog_name, sizeof(tree->vlog_name), "%s.vlog", filename);
+                tree->vlog_fd = open(tree->vlog_name, O_CREAT | O_RDWR, 0644);
+                assert(tree->vlog_fd >= 0);
+                ret = fstat(tree->vlog_fd, &st);
+                assert(ret == 0);
+                tree->vlog_size = vlog_align(st.st_size);
+                vlog_recover(tree);
+        }
+
+        /*上次关闭时保存的布隆过滤器*/
+        bloom_load(tree);
         return tree;
 }
 
+/*
+空闲区块偏移量降序比较
+*/
+static int offset_compare(const void *a, const void *b)
+{
+        off_t x = *(const off_t *) a, y = *(const off_t *) b;
+        return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+释放.index末尾的空闲区块和未使用的预分配空间
+末尾连续的空闲区块从空闲区块链表删除，文件截断到最后一个使用中的区块
+*/
+static void free_tail_release(struct bplus_tree *tree)
+{
+        int i, n = 0;
+        struct list_head *pos, *next;
+
+        list_for_each(pos, &tree->free_blocks) {
+                n++;
+        }
+        if (n > 0) {
+                off_t *offsets = malloc(n * sizeof(off_t));
+                assert(offsets != NULL);
+                i = 0;
+                list_for_each(pos, &tree->free_blocks) {
+                        offsets[i++] = list_entry(pos, struct free_block, link)->offset;
+                }
+                qsort(offsets, n, sizeof(off_t), offset_compare);
+                for (i = 0; i < n && offsets[i] == tree->file_size - _block_size; i++) {
+                        tree->file_size -= _block_size;
+                }
+                free(offsets);
+
+                if (i > 0) {
+                        list_for_each_safe(pos, next, &tree->free_blocks) {
+                                struct free_block *block = list_entry(pos, struct free_block, link);
+                                if (block->offset >= tree->file_size) {
+                                        list_del(pos);
+                                        free(block);
+                                }
+                        }
+                }
+        }
+        int ret = ftruncate(tree->fd, tree->file_size);
+        assert(ret == 0);
+}
+
 /*
 B+树的关闭操作
 打开.boot文件
 */
 void bplus_tree_deinit(struct bplus_tree *tree)
 {
-		/*向.boot写入B+树的3个配置数据*/
-        int fd = open(tree->filename, O_CREAT | O_RDWR, 0644);
+        /*整理延迟删除留下的欠满叶子节点*/
+        bplus_tree_maintain(tree, 0);
+
+        /*快照必须在关闭前全部释放，回收副本区块*/
+        assert(list_empty(&tree->snapshots));
+        if (tree->snap_buf != NULL) {
+                snapshot_reclaim(tree);
+                free(tree->snap_buf);
+        }
+        pthread_mutex_destroy(&tree->snap_lock);
+
+        /*释放末尾的空闲区块和预分配空间*/
+        free_tail_release(tree);
+
+        /*保存布隆过滤器，下次打开时不需要重建*/
+        bloom_store(tree);
+        bplus_tree_bloom_drop(tree);
+        bplus_tree_hot_cache(tree, 0, 0);
+        bplus_tree_adaptive_hash(tree, 0);
+        bplus_tree_learned_build(tree, 0);
+
+		/*向.boot写入B+树的3个配置数据，先清空旧内容，避免空闲块变少时残留旧的空闲块*/
+        int fd = open(tree->filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
         assert(fd >= 0);
-        assert(offset_store(fd, tree->root) == ADDR_STR_WIDTH);
-        assert(offset_store(fd, _block_size) == ADDR_STR_WIDTH);
-        assert(offset_store(fd, tree->file_size) == ADDR_STR_WIDTH);
+        int len = offset_store(fd, tree->root);
+        assert(len == ADDR_STR_WIDTH);
+        len = offset_store(fd, ((off_t) (tree->flags & ~BPLUS_TREE_DIRECT) << 32) | _block_size);
+        assert(len == ADDR_STR_WIDTH);
+        len = offset_store(fd, tree->file_size);
+        assert(len == ADDR_STR_WIDTH);
 
         /*将空闲块存储在文件中以备将来重用*/
         struct list_head *pos, *n;
         list_for_each_safe(pos, n, &tree->free_blocks) {
                 list_del(pos);
                 struct free_block *block = list_entry(pos, struct free_block, link);
-                assert(offset_store(fd, block->offset) == ADDR_STR_WIDTH);
+                len = offset_store(fd, block->offset);
+                assert(len == ADDR_STR_WIDTH);
                 free(block);
         }
 
         bplus_close(tree->fd);
+        if (tree->vlog_fd >= 0) {
+                vlog_unmap(tree);
+                close(tree->vlog_fd);
+        }
+        free(tree->post_buf);
         free(tree->caches);
         free(tree);
+        _open_trees--;
 }
 
 
@@ -1,12 +1,67 @@
 #ifndef _BPLUS_TREE_H
 #define _BPLUS_TREE_H
 
+#include<pthread.h>
+
 /*
 最少缓冲数目，缓冲最少需要5个
 节点自身，左兄弟节点，右兄弟节点，兄弟的兄弟节点，父节点
 */
 #define MIN_CACHE_NUM 5
 
+/*B+树的最大深度，用于记录从根节点到叶子节点的路径*/
+#define MAX_DEPTH 32
+
+/*快照页表的哈希桶个数*/
+#define SNAPSHOT_HASH_SIZE 1024
+
+/*布隆过滤器默认每个键值的位数，最多的哈希个数，最小的容量*/
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_MAX_HASHES 16
+#define BLOOM_MIN_KEYS 1024
+
+/*
+节点内的查找方式
+BPLUS_SEARCH_BINARY-----------二分查找
+BPLUS_SEARCH_INTERPOLATION----插值查找，探测INTERP_MAX_PROBES次后二分查找
+BPLUS_SEARCH_AUTO-------------每个节点根据第一个、最后一个键值和个数选择
+*/
+enum {
+        BPLUS_SEARCH_BINARY = 0,
+        BPLUS_SEARCH_INTERPOLATION = 1,
+        BPLUS_SEARCH_AUTO = 2,
+};
+
+/*插值查找的最少键值个数、最多探测次数，自动选择时键值的最大平均间隔*/
+#define INTERP_MIN_KEYS 8
+#define INTERP_MAX_PROBES 3
+#define INTERP_MAX_GAP 16
+
+/*探测次数直方图的格数，最后一格包括更多的次数*/
+#define SEARCH_PROBE_HIST 16
+
+/*
+节点内查找的统计信息
+long searches-----------------查找次数
+long interpolations-----------使用插值查找的次数
+long probes-------------------比较的总次数
+long histogram[]--------------每次查找的比较次数的分布
+*/
+struct bplus_search_stats {
+        long searches;
+        long interpolations;
+        long probes;
+        long histogram[SEARCH_PROBE_HIST];
+};
+
+/*叶子节点被查找到达多少次后加入自适应哈希索引*/
+#define AHI_HOT_HITS 8
+
+/*静态索引文件的标识，每个静态叶子的键值个数，每个缓存行的分隔键值个数*/
+#define STATIC_MAGIC "BPSTATIC"
+#define STATIC_LEAF_KEYS 16
+#define STATIC_SEPS_PER_LINE 8
+
 /*得到struct bplus_tree内free_blocks的偏移量*/
 #define list_entry(ptr, type, member) \
         ((type *)((char *)(ptr) - (size_t)(&((type *)0)->member)))
@@ -28,6 +83,20 @@
 
 typedef int key_t;
 
+/*
+B+树的可选功能，创建.index时由bplus_tree_init_flags设置，保存在.boot
+BPLUS_TREE_COUNTS-------非叶子节点保存每个分支的键值个数，用于排名、按排名查找和范围计数
+BPLUS_TREE_DIRECT-------以O_DIRECT方式打开.index，只使用B+树自己的节点缓存，每次打开时设置，不保存
+BPLUS_TREE_MULTI--------多值模式，每个键值对应一个有序的值列表，值不能小于0
+BPLUS_TREE_VLOG---------值日志模式，值为任意长度的字节串，长值保存在.index.vlog，不能和多值模式同时使用
+*/
+enum {
+        BPLUS_TREE_COUNTS = 0x1,
+        BPLUS_TREE_DIRECT = 0x2,
+        BPLUS_TREE_MULTI = 0x4,
+        BPLUS_TREE_VLOG = 0x8,
+};
+
 /*
 链表头部
 记录前一个节点和后一个节点
@@ -162,6 +231,16 @@ typedef struct free_block {
         off_t offset;
 } free_block;
 
+/*
+待整理的欠满叶子节点，延迟删除模式下加入队列，由bplus_tree_maintain合并或借数据
+struct list_head link---------链表头部，指向上一个节点和下一个节点
+off_t offset------------------叶子节点的偏移地址
+*/
+typedef struct lazy_leaf {
+        struct list_head link;
+        off_t offset;
+} lazy_leaf;
+
 /*
 定义B+树信息结构体
 char *caches------------------------节点缓存，存放B+树节点的内存缓冲，最少5个，包括：自身节点，父节点，左兄弟节点，右兄弟节点，兄弟的兄弟节点
@@ -170,8 +249,42 @@ char filename[1024];----------------文件名字
 int fd------------------------------文件描述符指向index
 int level---------------------------文件等级
 off_t root--------------------------B+树根节点
+off_t tail--------------------------最右叶子节点，顺序插入时直接追加，不从根节点查找；未知时为非法偏移量
 off_t file_size---------------------文件大小
 struct list_head free_blocks--------链表指针
+int lazy_threshold------------------延迟删除阈值，小于0为立即合并，否则叶子节点数据不少于该值时只删除不合并
+struct list_head lazy_leaves--------待整理的欠满叶子节点队列
+int flags---------------------------可选功能，BPLUS_TREE_COUNTS等
+off_t alloc_size--------------------.index已预分配的大小，不小于file_size
+off_t extent------------------------下一次预分配的大小，为0时不预分配
+pthread_mutex_t snap_lock-----------快照锁，保护快照链表、快照页表和待回收的副本区块
+struct list_head snapshots----------存在的快照
+struct list_head snap_reclaim-------快照释放后待回收的副本区块
+char *snap_buf----------------------保存旧内容用的缓冲区，创建第一个快照时分配
+char *post_buf----------------------多值模式读写溢出页的缓冲区
+int vlog_fd-------------------------值日志的文件描述符，不是值日志模式时为-1
+off_t vlog_size---------------------值日志的大小，新的记录追加到这里
+char *vlog_map----------------------值日志的内存映射
+size_t vlog_mapped------------------已映射的大小
+char vlog_name[1024]----------------值日志的文件名字
+unsigned char vlog_inline[8]--------映射读取短值时使用的缓冲区
+unsigned char *bloom----------------布隆过滤器的位图，没有过滤器时为NULL
+long bloom_bits---------------------位图的位数
+int bloom_hashes--------------------哈希个数
+long bloom_keys---------------------加入过滤器的键值个数
+long bloom_capacity-----------------建立过滤器时的容量，加入的键值超过容量2倍时由bplus_tree_maintain重建
+long bloom_lookups------------------查询过滤器的次数
+long bloom_negatives----------------过滤器判断不存在的次数
+long bloom_false--------------------过滤器判断可能存在但键值不存在的次数
+struct hot_shard *hot---------------热点缓存的分片，没有缓存时为NULL
+int hot_shards----------------------分片个数，2的幂
+struct adaptive_hash *ahi-----------自适应哈希索引，没有时为NULL
+struct learned_index *learned-------学习索引，没有时为NULL
+long write_full---------------------写整个区块的次数
+long write_partial------------------只写修改过的扇区的次数
+long write_bytes--------------------写入节点的总字节数
+int search_mode---------------------节点内查找方式，BPLUS_SEARCH_BINARY等
+struct bplus_search_stats search_stats---节点内查找的次数和比较次数
 */
 struct bplus_tree {
         char *caches;
@@ -180,28 +293,693 @@ struct bplus_tree {
         int fd;
         int level;
         off_t root;
+        off_t tail;
         off_t file_size;
         struct list_head free_blocks;
+        int lazy_threshold;
+        struct list_head lazy_leaves;
+        int flags;
+        off_t alloc_size;
+        off_t extent;
+        pthread_mutex_t snap_lock;
+        struct list_head snapshots;
+        struct list_head snap_reclaim;
+        char *snap_buf;
+        char *post_buf;
+        int vlog_fd;
+        off_t vlog_size;
+        char *vlog_map;
+        size_t vlog_mapped;
+        char vlog_name[1024];
+        unsigned char vlog_inline[8];
+        unsigned char *bloom;
+        long bloom_bits;
+        int bloom_hashes;
+        long bloom_keys;
+        long bloom_capacity;
+        long bloom_lookups;
+        long bloom_negatives;
+        long bloom_false;
+        struct hot_shard *hot;
+        int hot_shards;
+        struct adaptive_hash *ahi;
+        struct learned_index *learned;
+        long write_full;
+        long write_partial;
+        long write_bytes;
+        int search_mode;
+        struct bplus_search_stats search_stats;
+};
+
+/*
+学习索引中的一段线性模型，预测位置为start+slope*(键值-key)
+*/
+struct learned_segment {
+        key_t key;
+        long start;
+        double slope;
+};
+
+/*
+学习索引
+key_t *keys-------------------按顺序的非空叶子节点的第一个键值
+off_t *leaves-----------------叶子节点的偏移量
+long n------------------------叶子节点个数
+long cap----------------------数组容量
+struct learned_segment *segs--分段线性模型
+long nsegs--------------------段数
+int eps-----------------------拟合时的最大误差
+int drift---------------------拟合后数组插入和删除的次数，查找窗口相应扩大
+int stale---------------------数组不再有序，下一次查找时从叶子节点链表重建
+*/
+struct learned_index {
+        key_t *keys;
+        off_t *leaves;
+        long n;
+        long cap;
+        struct learned_segment *segs;
+        long nsegs;
+        int eps;
+        int drift;
+        int stale;
+        long hits;
+        long misses;
+        long refits;
+        long rebuilds;
+};
+
+/*
+学习索引的统计信息
+long hits---------------------只读取一个叶子节点的查找次数
+long misses-------------------窗口没有覆盖或者叶子节点不对，从根节点查找的次数
+long refits-------------------重新拟合模型的次数
+long rebuilds-----------------从叶子节点链表重建的次数
+*/
+struct bplus_learned_stats {
+        long leaves;
+        long segments;
+        int eps;
+        int drift;
+        long hits;
+        long misses;
+        long refits;
+        long rebuilds;
+};
+
+/*
+自适应哈希索引中的键值
+key_t key---------------------键值
+int next----------------------哈希链中的下一项
+int lnext---------------------同一叶子节点的下一个键值，或者空闲链表中的下一项
+off_t leaf--------------------键值所在的叶子节点
+*/
+struct ahi_entry {
+        key_t key;
+        int next;
+        int lnext;
+        off_t leaf;
+};
+
+/*
+自适应哈希索引中的叶子节点记录
+off_t offset------------------叶子节点的偏移量
+int next----------------------哈希链或者空闲链表中的下一项
+int hits----------------------查找到达的次数，达到AHI_HOT_HITS后不再增加
+int keys----------------------指向该叶子节点的键值链表
+*/
+struct ahi_leaf {
+        off_t offset;
+        int next;
+        int hits;
+        int keys;
+};
+
+/*
+自适应哈希索引，键值和叶子节点记录各自用数组保存，用完时清空
+*/
+struct adaptive_hash {
+        struct ahi_entry *entries;
+        int *buckets;
+        int capacity;
+        int count;
+        int free;
+        struct ahi_leaf *leaves;
+        int *leaf_buckets;
+        int leaf_capacity;
+        int leaf_count;
+        int leaf_free;
+        long hits;
+        long misses;
+        long drops;
+        long resets;
+};
+
+/*
+自适应哈希索引的统计信息
+long capacity-----------------最多索引的键值个数
+long keys---------------------已索引的键值个数
+long leaves-------------------已索引的叶子节点个数
+long hits---------------------直接跳到叶子节点的次数
+long misses-------------------从根节点查找的次数
+long drops--------------------叶子节点记录被删除的次数
+long resets-------------------索引用完被清空的次数
+*/
+struct bplus_ahi_stats {
+        long capacity;
+        long keys;
+        long leaves;
+        long hits;
+        long misses;
+        long drops;
+        long resets;
+};
+
+/*
+批量查找中的一次查找
+key_t key---------------------查找的键值
+int index---------------------在调用者数组中的位置
+off_t offset------------------下一层要读取的节点，已得到结果时为非法偏移量
+*/
+struct batch_lookup {
+        key_t key;
+        int index;
+        off_t offset;
+};
+
+/*
+热点缓存项
+key_t key---------------------键值
+int next----------------------哈希链或者空闲链表中的下一项，-1表示结束
+long data---------------------数据
+unsigned char ref-------------CLOCK访问位
+unsigned char used------------是否使用中
+*/
+struct hot_entry {
+        key_t key;
+        int next;
+        long data;
+        unsigned char ref;
+        unsigned char used;
+};
+
+/*
+热点缓存分片
+struct hot_entry *entries-----缓存项数组，CLOCK指针在数组上循环
+int *buckets------------------哈希桶，保存缓存项的位置，-1表示空
+int nbuckets------------------哈希桶个数
+int capacity------------------缓存项个数上限
+int count---------------------已经使用过的缓存项个数
+int free----------------------失效后空闲的缓存项链表
+int hand----------------------CLOCK指针
+long hits---------------------命中次数
+long misses-------------------未命中次数
+long evictions----------------淘汰次数
+*/
+struct hot_shard {
+        struct hot_entry *entries;
+        int *buckets;
+        int nbuckets;
+        int capacity;
+        int count;
+        int free;
+        int hand;
+        long hits;
+        long misses;
+        long evictions;
+};
+
+/*
+热点缓存的统计信息
+*/
+struct bplus_hot_stats {
+        long capacity;
+        long entries;
+        long hits;
+        long misses;
+        long evictions;
+};
+
+/*
+布隆过滤器的统计信息
+long bits---------------------位图的位数
+int hashes--------------------哈希个数
+long keys---------------------加入过滤器的键值个数，包括已删除的
+long lookups------------------查询次数
+long negatives----------------判断不存在，省去查找的次数
+long false_positives----------判断可能存在但键值不存在的次数
+double fpr_expected-----------由置位比例计算的误判率
+double fpr_observed-----------实际的误判率
+*/
+struct bplus_bloom_stats {
+        long bits;
+        int hashes;
+        long keys;
+        long lookups;
+        long negatives;
+        long false_positives;
+        double fpr_expected;
+        double fpr_observed;
+};
+
+/*
+节点写入的统计信息
+long full_writes--------------写整个区块的次数
+long partial_writes-----------只写修改过的扇区的次数
+long bytes--------------------写入节点的总字节数
+*/
+struct bplus_write_stats {
+        long full_writes;
+        long partial_writes;
+        long bytes;
+};
+
+/*
+值日志中的记录头，之后是值，记录按8字节对齐
+key_t key---------------------键值，垃圾回收时用来查找叶子节点
+unsigned int len--------------值的长度
+*/
+typedef struct vlog_record {
+        key_t key;
+        unsigned int len;
+} vlog_record;
+
+/*
+多值模式下值列表的溢出页，页头之后是差值编码的值
+每一页的第一个值完整保存在页头，之后每个值保存和前一个值的差，变长编码
+off_t next--------------------下一个溢出页
+off_t tail--------------------最后一个溢出页，只在第一页有效
+long total--------------------值列表的值个数，只在第一页有效
+long first--------------------本页第一个值
+long last---------------------本页最后一个值
+int count---------------------本页值个数
+int bytes---------------------本页差值编码占用的字节数
+*/
+typedef struct posting_page {
+        off_t next;
+        off_t tail;
+        long total;
+        long first;
+        long last;
+        int count;
+        int bytes;
+} posting_page;
+
+/*
+快照保存的区块副本，多个快照可以共享同一个副本
+off_t offset------------------副本在.index中的偏移量
+int refs----------------------引用副本的快照个数
+*/
+typedef struct snapshot_copy {
+        off_t offset;
+        int refs;
+} snapshot_copy;
+
+/*
+快照页表项，记录快照创建后被覆盖的区块和它的副本
+struct snapshot_page *next----哈希桶内的下一项
+off_t offset------------------被覆盖的区块偏移量
+struct snapshot_copy *copy----保存的旧内容
+*/
+typedef struct snapshot_page {
+        struct snapshot_page *next;
+        off_t offset;
+        struct snapshot_copy *copy;
+} snapshot_page;
+
+/*
+只读快照
+struct list_head link---------链表头部，指向上一个快照和下一个快照
+struct bplus_tree *tree-------所属的B+树
+off_t root--------------------创建时的根节点
+off_t file_size---------------创建时的文件大小，之后新分配的区块不在快照中
+char *buf---------------------读取节点的缓冲区
+struct snapshot_page *pages---页表，快照创建后被覆盖的区块
+*/
+struct bplus_snapshot {
+        struct list_head link;
+        struct bplus_tree *tree;
+        off_t root;
+        off_t file_size;
+        char *buf;
+        struct snapshot_page *pages[SNAPSHOT_HASH_SIZE];
+};
+
+/*
+静态索引的文件头，占一个缓存行
+char magic[8]-----------------文件标识STATIC_MAGIC
+long entries------------------键值个数
+long leaves-------------------静态叶子个数
+long eyt_offset---------------Eytzinger数组在文件中的偏移量
+*/
+typedef struct bplus_static_header {
+        char magic[8];
+        long entries;
+        long leaves;
+        long eyt_offset;
+        char reserved[32];
+} bplus_static_header;
+
+/*
+静态叶子，全满，键值占一个缓存行，数据紧随其后
+*/
+typedef struct static_leaf {
+        key_t key[STATIC_LEAF_KEYS];
+        long data[STATIC_LEAF_KEYS];
+} static_leaf;
+
+/*
+Eytzinger数组的元素
+key_t key---------------------静态叶子的第一个键值
+int leaf----------------------静态叶子的序号
+*/
+typedef struct static_sep {
+        key_t key;
+        int leaf;
+} static_sep;
+
+/*
+映射到内存的静态索引，只读，可以在多个线程中同时使用
+char *map---------------------映射的首地址
+size_t size-------------------映射的大小
+long entries------------------键值个数
+long leaves-------------------静态叶子个数
+struct static_leaf *leaf------静态叶子数组
+struct static_sep *eyt--------Eytzinger数组，eyt[0]不使用
+*/
+struct bplus_static {
+        char *map;
+        size_t size;
+        long entries;
+        long leaves;
+        struct static_leaf *leaf;
+        struct static_sep *eyt;
+};
+
+/*并行扫描时每个线程平均分到的分区个数，分区多一些负载更均衡*/
+#define SCAN_PARTS_PER_THREAD 4
+
+/*
+范围聚合的结果，没有键值时min和max为0
+long count--------------------键值个数
+long sum----------------------数据的和
+long min----------------------最小的数据
+long max----------------------最大的数据
+*/
+struct bplus_aggregate {
+        long count;
+        long sum;
+        long min;
+        long max;
+};
+
+/*
+叶子节点扫描时值的过滤条件、输出和聚合结果
+long lo-----------------------值的下限，包含
+long hi-----------------------值的上限，包含
+key_t *keys-------------------输出满足条件的键值，可以为NULL
+long *data--------------------输出满足条件的数据，可以为NULL
+int max-----------------------最多输出的个数
+int n-------------------------已输出的个数
+struct bplus_aggregate acc----满足条件的数据的聚合结果
+*/
+struct scan_filter {
+        long lo;
+        long hi;
+        key_t *keys;
+        long *data;
+        int max;
+        int n;
+        struct bplus_aggregate acc;
+};
+
+/*
+并行扫描任务，范围按分隔键值分成多个分区，线程每次取一个分区扫描，部分结果最后合并
+struct bplus_tree *tree-------扫描的B+树
+key_t *bounds-----------------分区i从bounds[i]到bounds[i+1]-1，最后一个分区到max
+int parts---------------------分区个数
+key_t max---------------------范围的最大键值
+int next----------------------下一个未扫描的分区
+struct bplus_aggregate result-合并的结果
+int error---------------------线程创建或者缓冲区申请失败，结果不完整
+pthread_mutex_t lock----------保护next、result和error
+*/
+struct scan_job {
+        struct bplus_tree *tree;
+        key_t *bounds;
+        int parts;
+        key_t max;
+        int next;
+        struct bplus_aggregate result;
+        int error;
+        pthread_mutex_t lock;
+};
+
+/*批量建立时每个顺串的最少记录个数，合并时每个顺串的读缓冲的最少记录个数*/
+#define BULK_MIN_RUN 4096
+#define BULK_MIN_READ 256
+
+/*
+批量建立的输入记录，输入文件是这种记录的数组，不需要有序
+key_t key---------------------键值
+long data---------------------数据，为0的记录被忽略
+*/
+struct bplus_record {
+        key_t key;
+        long data;
+};
+
+/*
+批量建立的排序任务，多个线程各自取一个顺串，读入、排序后写到临时文件的相同位置
+int in_fd---------------------输入文件
+int tmp_fd--------------------临时文件，保存排好序的顺串
+long records------------------输入的记录个数
+long run_len------------------每个顺串的记录个数
+long runs---------------------顺串个数
+long next---------------------下一个未排序的顺串
+int error---------------------读写出错
+pthread_mutex_t lock----------保护next和error
+*/
+struct bulk_sort {
+        int in_fd;
+        int tmp_fd;
+        long records;
+        long run_len;
+        long runs;
+        long next;
+        int error;
+        pthread_mutex_t lock;
+};
+
+/*
+合并时一个顺串的读取位置
+struct bplus_record *buf------读缓冲
+int n-------------------------缓冲中的记录个数
+int i-------------------------缓冲中下一个记录的位置
+off_t pos---------------------顺串在临时文件中下一次读取的位置
+off_t end---------------------顺串在临时文件中的结束位置
+*/
+struct bulk_run {
+        struct bplus_record *buf;
+        int n;
+        int i;
+        off_t pos;
+        off_t end;
+};
+
+/*
+批量建立时每一层正在填充的节点，节点填满后写入，开始它的右兄弟
+char *nodes-------------------每一层一个区块大小的节点，第0层为叶子节点
+long counts[]-----------------每一层正在填充的节点下的键值个数
+int height--------------------已有的层数
+*/
+struct bulk_builder {
+        char *nodes;
+        long counts[MAX_DEPTH];
+        int height;
+};
+
+/*
+分区方式
+BPLUS_SHARD_RANGE-------------按键值范围分区，分区边界可以在线调整
+BPLUS_SHARD_HASH--------------按键值的哈希分区
+*/
+enum {
+        BPLUS_SHARD_RANGE = 0,
+        BPLUS_SHARD_HASH = 1,
+};
+
+/*最多的分区个数，范围扫描时每个分区每次读取的键值个数，调整边界时每次移动的最多键值个数*/
+#define SHARD_MAX 256
+#define SHARD_SCAN_CHUNK 256
+#define SHARD_MOVE_BATCH 4096
+
+/*边界左边的键值个数偏离平均分配的个数超过平均每个分区的1/SHARD_TOLERANCE，并且至少SHARD_MIN_MOVE个时调整边界*/
+#define SHARD_TOLERANCE 8
+#define SHARD_MIN_MOVE 256
+
+/*
+分区的B+树，每个分区是独立的B+树，有自己的.index、.boot和文件描述符
+分区表保存在<filename>.shards，分区i的文件为<filename>.i
+char filename[1024]-----------分区表的文件名字，不包括.shards
+int block_size----------------每个分区的区块大小
+int mode----------------------分区方式，BPLUS_SHARD_RANGE或BPLUS_SHARD_HASH
+int count---------------------分区个数
+struct bplus_tree **trees-----每个分区的B+树
+key_t *bounds-----------------范围分区时每个分区的最小键值，bounds[0]为INT_MIN
+long *keys--------------------每个分区的键值个数
+pthread_mutex_t *locks--------每个分区的锁，同一时间一个分区只有一个线程读写
+pthread_rwlock_t route--------分区表的读写锁，调整边界时独占
+*/
+struct bplus_shards {
+        char filename[1024];
+        int block_size;
+        int mode;
+        int count;
+        struct bplus_tree **trees;
+        key_t *bounds;
+        long *keys;
+        pthread_mutex_t *locks;
+        pthread_rwlock_t route;
+};
+
+/*
+分区范围扫描中一个分区的读取位置
+key_t keys[]------------------已读取的键值
+long data[]-------------------已读取的数据
+int n-------------------------已读取的个数
+int pos-----------------------下一个合并的位置
+key_t next--------------------下一次读取的起始键值
+int done----------------------分区已读完
+*/
+struct shard_cursor {
+        key_t keys[SHARD_SCAN_CHUNK];
+        long data[SHARD_SCAN_CHUNK];
+        int n;
+        int pos;
+        key_t next;
+        int done;
 };
 
 /*
 以下是B+树库所提供的外部接口，static函数无法在其他文件使用，需通过以下函数调用
 bplus_tree_dump-----------------------绘图
 bplus_tree_get------------------------查找
+bplus_tree_get_batch------------------批量查找
 bplus_tree_put------------------------插入和删除
 bplus_tree_get_range------------------范围查找
+bplus_tree_get_range_desc-------------降序范围查找
+bplus_tree_aggregate------------------多线程并行的范围聚合
+bplus_tree_scan_filter----------------按值过滤的范围扫描
+bplus_tree_scan_aggregate-------------按值过滤的范围聚合
+bplus_tree_get_last-------------------查找小于等于键值的最后n个键值
+bplus_tree_lazy_delete----------------设置延迟删除阈值
+bplus_tree_maintain-------------------整理延迟删除留下的欠满叶子节点
+bplus_tree_delete_range---------------范围删除
+bplus_tree_update---------------------原地更新已存在键值的数据
+bplus_tree_upsert---------------------插入或更新
+bplus_tree_multi_add------------------多值模式下追加值
+bplus_tree_multi_remove---------------多值模式下删除值
+bplus_tree_multi_get------------------多值模式下读取键值的全部值
+bplus_tree_put_value------------------值日志模式下插入或替换任意长度的值
+bplus_tree_get_value------------------值日志模式下读取值到缓冲区
+bplus_tree_map_value------------------值日志模式下通过内存映射读取值
+bplus_tree_vlog_gc--------------------值日志垃圾回收
+bplus_tree_hot_cache------------------设置热点缓存
+bplus_tree_hot_stats------------------热点缓存的统计信息
+bplus_tree_adaptive_hash--------------设置自适应哈希索引
+bplus_tree_adaptive_hash_stats--------自适应哈希索引的统计信息
+bplus_tree_search_mode----------------设置节点内的查找方式
+bplus_tree_search_stats---------------节点内查找的统计信息
+bplus_tree_learned_build--------------设置学习索引
+bplus_tree_learned_stats--------------学习索引的统计信息
+bplus_tree_bloom_build----------------建立或重建布隆过滤器
+bplus_tree_bloom_drop-----------------释放布隆过滤器
+bplus_tree_bloom_stats----------------布隆过滤器的统计信息
+bplus_tree_write_stats----------------节点写入的统计信息
+bplus_tree_bulk_build-----------------从无序的输入文件批量建立B+树
+bplus_tree_rank-----------------------小于键值的键值个数
+bplus_tree_count_range----------------范围计数
+bplus_tree_select---------------------按排名查找
+bplus_tree_snapshot-------------------创建只读快照
+bplus_snapshot_release----------------释放快照
+bplus_snapshot_get--------------------在快照中查找
+bplus_snapshot_get_range--------------在快照中范围查找
+bplus_tree_export---------------------导出只读的静态索引文件
+bplus_static_open---------------------打开静态索引
+bplus_static_close--------------------关闭静态索引
+bplus_static_get----------------------在静态索引中查找
+bplus_static_scan---------------------在静态索引中范围扫描
+bplus_shards_open---------------------打开或创建分区的B+树
+bplus_shards_close--------------------关闭分区的B+树
+bplus_shards_get----------------------在分区的B+树中查找
+bplus_shards_put----------------------在分区的B+树中插入和删除
+bplus_shards_get_range----------------在全部分区中范围查找，结果按键值合并
+bplus_shards_rebalance----------------调整范围分区的边界
 bplus_tree_init-----------------------B+树初始化
+bplus_tree_init_flags-----------------B+树初始化，新建时设置可选功能
 bplus_tree_deinit---------------------B+树关闭操作
 bplus_open----------------------------B+树开启操作
+bplus_open_direct---------------------以O_DIRECT方式开启B+树
 bplus_close---------------------------B+树关闭操作
 */
 void bplus_tree_dump(struct bplus_tree *tree);
 long bplus_tree_get(struct bplus_tree *tree, key_t key);
+int bplus_tree_get_batch(struct bplus_tree *tree, key_t *keys, long *data, int n);
 int bplus_tree_put(struct bplus_tree *tree, key_t key, long data);
 long bplus_tree_get_range(struct bplus_tree *tree, key_t key1, key_t key2);
+int bplus_tree_get_range_desc(struct bplus_tree *tree, key_t key1, key_t key2, key_t *keys, long *data, int max);
+int bplus_tree_aggregate(struct bplus_tree *tree, key_t key1, key_t key2, int threads, struct bplus_aggregate *result);
+int bplus_tree_scan_filter(struct bplus_tree *tree, key_t key1, key_t key2, long lo, long hi, key_t *keys, long *data, int max);
+int bplus_tree_scan_aggregate(struct bplus_tree *tree, key_t key1, key_t key2, long lo, long hi, struct bplus_aggregate *result);
+int bplus_tree_get_last(struct bplus_tree *tree, key_t key, key_t *keys, long *data, int n);
+void bplus_tree_lazy_delete(struct bplus_tree *tree, int threshold);
+int bplus_tree_maintain(struct bplus_tree *tree, int max);
+int bplus_tree_delete_range(struct bplus_tree *tree, key_t key1, key_t key2);
+int bplus_tree_update(struct bplus_tree *tree, key_t key, long data);
+int bplus_tree_upsert(struct bplus_tree *tree, key_t key, long data);
+int bplus_tree_multi_add(struct bplus_tree *tree, key_t key, long value);
+int bplus_tree_multi_remove(struct bplus_tree *tree, key_t key, long value);
+long bplus_tree_multi_get(struct bplus_tree *tree, key_t key, long *values, long max);
+int bplus_tree_put_value(struct bplus_tree *tree, key_t key, const void *value, long len);
+long bplus_tree_get_value(struct bplus_tree *tree, key_t key, void *buf, long size);
+const void *bplus_tree_map_value(struct bplus_tree *tree, key_t key, long *len);
+long bplus_tree_vlog_gc(struct bplus_tree *tree);
+void bplus_tree_hot_cache(struct bplus_tree *tree, long capacity, int shards);
+void bplus_tree_hot_stats(struct bplus_tree *tree, struct bplus_hot_stats *stats);
+void bplus_tree_adaptive_hash(struct bplus_tree *tree, long capacity);
+void bplus_tree_adaptive_hash_stats(struct bplus_tree *tree, struct bplus_ahi_stats *stats);
+void bplus_tree_search_mode(struct bplus_tree *tree, int mode);
+void bplus_tree_search_stats(struct bplus_tree *tree, struct bplus_search_stats *stats, int reset);
+long bplus_tree_learned_build(struct bplus_tree *tree, int eps);
+void bplus_tree_learned_stats(struct bplus_tree *tree, struct bplus_learned_stats *stats);
+long bplus_tree_bloom_build(struct bplus_tree *tree, long capacity, int bits_per_key);
+void bplus_tree_bloom_drop(struct bplus_tree *tree);
+void bplus_tree_bloom_stats(struct bplus_tree *tree, struct bplus_bloom_stats *stats);
+void bplus_tree_write_stats(struct bplus_tree *tree, struct bplus_write_stats *stats, int reset);
+long bplus_tree_bulk_build(struct bplus_tree *tree, char *input, int threads, long memory);
+long bplus_tree_rank(struct bplus_tree *tree, key_t key);
+long bplus_tree_count_range(struct bplus_tree *tree, key_t key1, key_t key2);
+int bplus_tree_select(struct bplus_tree *tree, long k, key_t *key, long *data);
+struct bplus_snapshot *bplus_tree_snapshot(struct bplus_tree *tree);
+void bplus_snapshot_release(struct bplus_snapshot *snap);
+long bplus_snapshot_get(struct bplus_snapshot *snap, key_t key);
+long bplus_snapshot_get_range(struct bplus_snapshot *snap, key_t key1, key_t key2);
+long bplus_tree_export(struct bplus_tree *tree, char *filename);
+struct bplus_static *bplus_static_open(char *filename);
+void bplus_static_close(struct bplus_static *index);
+long bplus_static_get(struct bplus_static *index, key_t key);
+int bplus_static_scan(struct bplus_static *index, key_t key1, key_t key2, key_t *keys, long *data, int max);
+struct bplus_shards *bplus_shards_open(char *filename, int block_size, int count, int mode);
+void bplus_shards_close(struct bplus_shards *shards);
+long bplus_shards_get(struct bplus_shards *shards, key_t key);
+int bplus_shards_put(struct bplus_shards *shards, key_t key, long data);
+int bplus_shards_get_range(struct bplus_shards *shards, key_t key1, key_t key2, key_t *keys, long *data, int max);
+long bplus_shards_rebalance(struct bplus_shards *shards);
 struct bplus_tree *bplus_tree_init(char *filename, int block_size);
+struct bplus_tree *bplus_tree_init_flags(char *filename, int block_size, int flags);
 void bplus_tree_deinit(struct bplus_tree *tree);
 int bplus_open(char *filename);
+int bplus_open_direct(char *filename);
 void bplus_close(int fd);
 
 /*_BPLUS_TREE_H*/
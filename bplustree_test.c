@@ -0,0 +1,378 @@
+/*
+B+树测试
+随机插入和删除，定期关闭后重新打开，每一轮检查磁盘上的结构和查找结果
+覆盖普通树、带子树计数的树、布隆过滤器和值日志
+直接包含bplustree.c，检查时可以使用内部的宏和空闲区块链表
+*/
+#include"bplustree.c"
+
+#define TEST_FILE "/tmp/bplustree_test.index"
+#define TEST_KEYS 20000
+#define TEST_DEPTH 32
+
+/*参照：每个键值是否存在和对应的数据*/
+static long ref[TEST_KEYS];
+static int present[TEST_KEYS];
+static long nkeys;
+
+/*检查时每一层上一个节点的偏移量，用于检查兄弟链表*/
+static off_t last_node[TEST_DEPTH];
+/*检查时遍历到的区块，空闲区块链表中不能出现*/
+static char *live;
+static long live_size;
+
+#define fail(...) do { printf(__VA_ARGS__); printf("\n"); exit(1); } while (0)
+
+/*
+删除测试产生的所有文件
+*/
+static void test_unlink(void)
+{
+        static const char *suffix[] = { "", ".boot", ".vlog", ".vlog.gc", ".vlog.old", ".bloom" };
+        char name[1100];
+        int i;
+        for (i = 0; i < (int) (sizeof(suffix) / sizeof(suffix[0])); i++) {
+                snprintf(name, sizeof(name), "%s%s", TEST_FILE, suffix[i]);
+                unlink(name);
+        }
+}
+
+/*
+绕过缓存直接从文件读取节点
+*/
+static struct bplus_node *test_read(struct bplus_tree *tree, off_t offset)
+{
+        struct bplus_node *node;
+        if (posix_memalign((void **) &node, DIRECT_IO_ALIGN, _block_size) != 0) {
+                fail("out of memory");
+        }
+        if (pread(tree->fd, node, _block_size, offset) != _block_size) {
+                fail("short read at %lx", (long) offset);
+        }
+        return node;
+}
+
+/*
+检查以offset为根的子树
+键值在[lo, hi)之间并且有序，数据和参照一致，所有叶子在同一层
+父节点、兄弟链表和子树计数正确
+返回--------------------------子树的键值个数
+*/
+static long test_check(struct bplus_tree *tree, off_t offset, off_t parent, int depth, long lo, long hi, int *leaf_depth)
+{
+        struct bplus_node *node = test_read(tree, offset);
+        long total = 0;
+        int i;
+
+        if (node->self != offset) {
+                fail("self %lx at %lx", (long) node->self, (long) offset);
+        }
+        if (node->parent != parent) {
+                fail("parent %lx at %lx, expect %lx", (long) node->parent, (long) offset, (long) parent);
+        }
+        if (node->prev != last_node[depth]) {
+                fail("prev %lx at %lx, expect %lx", (long) node->prev, (long) offset, (long) last_node[depth]);
+        }
+        if (last_node[depth] != INVALID_OFFSET) {
+                struct bplus_node *prev = test_read(tree, last_node[depth]);
+                if (prev->next != offset) {
+                        fail("next %lx at %lx, expect %lx", (long) prev->next, (long) last_node[depth], (long) offset);
+                }
+                free(prev);
+        }
+        last_node[depth] = offset;
+        if (offset / _block_size >= live_size) {
+                long old = live_size;
+                live_size = offset / _block_size * 2 + 64;
+                live = realloc(live, live_size);
+                memset(live + old, 0, live_size - old);
+        }
+        live[offset / _block_size] = 1;
+
+        if (is_leaf(node)) {
+                if (*leaf_depth < 0) {
+                        *leaf_depth = depth;
+                }
+                if (*leaf_depth != depth) {
+                        fail("leaf %lx at depth %d, expect %d", (long) offset, depth, *leaf_depth);
+                }
+                if (node->children <= 0 || node->children > _max_entries) {
+                        fail("leaf %lx has %d entries", (long) offset, node->children);
+                }
+                for (i = 0; i < node->children; i++) {
+                        key_t k = key(node)[i];
+                        if (k < lo || k >= hi || (i > 0 && key(node)[i - 1] >= k)) {
+                                fail("leaf %lx key %d out of order", (long) offset, k);
+                        }
+                        if (k < 0 || k >= TEST_KEYS || !present[k]) {
+                                fail("extra key %d", k);
+                        }
+                        if (!(tree->flags & BPLUS_TREE_VLOG) && data(node)[i] != ref[k]) {
+                                fail("key %d data %ld, expect %ld", k, data(node)[i], ref[k]);
+                        }
+                }
+                total = node->children;
+        } else {
+                if (node->children < 2 || node->children > _max_order) {
+                        fail("internal %lx has %d children", (long) offset, node->children);
+                }
+                for (i = 0; i < node->children; i++) {
+                        long sub_lo = i == 0 ? lo : key(node)[i - 1];
+                        long sub_hi = i == node->children - 1 ? hi : key(node)[i];
+                        if (sub_lo > sub_hi) {
+                                fail("internal %lx separators out of order", (long) offset);
+                        }
+                        long c = test_check(tree, sub(node)[i], offset, depth + 1, sub_lo, sub_hi, leaf_depth);
+                        if ((tree->flags & BPLUS_TREE_COUNTS) && count(node)[i] != c) {
+                                fail("internal %lx count[%d] %ld, expect %ld", (long) offset, i, count(node)[i], c);
+                        }
+                        total += c;
+                }
+        }
+        free(node);
+        return total;
+}
+
+/*
+检查整棵树的结构，空闲区块不能被树使用
+*/
+static void test_validate(struct bplus_tree *tree)
+{
+        struct list_head *pos;
+        int i, leaf_depth = -1;
+
+        for (i = 0; i < TEST_DEPTH; i++) {
+                last_node[i] = INVALID_OFFSET;
+        }
+        if (live != NULL) {
+                memset(live, 0, live_size);
+        }
+        if (tree->root == INVALID_OFFSET) {
+                if (nkeys != 0) {
+                        fail("empty tree, expect %ld keys", nkeys);
+                }
+                return;
+        }
+        long total = test_check(tree, tree->root, INVALID_OFFSET, 0, INT_MIN, (long) INT_MAX + 1, &leaf_depth);
+        if (total != nkeys) {
+                fail("tree has %ld keys, expect %ld", total, nkeys);
+        }
+        list_for_each(pos, &tree->free_blocks) {
+                struct free_block *block = list_entry(pos, struct free_block, link);
+                if (block->offset >= tree->file_size) {
+                        fail("free block %lx beyond end of file", (long) block->offset);
+                }
+                if (block->offset / _block_size < live_size && live[block->offset / _block_size]) {
+                        fail("free block %lx is in use", (long) block->offset);
+                }
+        }
+        for (i = 0; i < TEST_DEPTH; i++) {
+                if (last_node[i] != INVALID_OFFSET) {
+                        struct bplus_node *node = test_read(tree, last_node[i]);
+                        if (node->next != INVALID_OFFSET) {
+                                fail("last node %lx has next %lx", (long) last_node[i], (long) node->next);
+                        }
+                        free(node);
+                }
+        }
+}
+
+/*
+值日志模式下的值由键值和数据生成，长度跨过内联的边界
+*/
+static long test_value(key_t key, long data, char *buf)
+{
+        long i, len = data % 300;
+        for (i = 0; i < len; i++) {
+                buf[i] = (char) (key * 31 + data + i);
+        }
+        return len;
+}
+
+/*
+通过查找接口检查参照中的一部分键值
+*/
+static void test_gets(struct bplus_tree *tree)
+{
+        char value[300], expect[300];
+        int k;
+        for (k = 0; k < TEST_KEYS; k += 7) {
+                if (tree->flags & BPLUS_TREE_VLOG) {
+                        long len = bplus_tree_get_value(tree, k, value, sizeof(value));
+                        if (!present[k]) {
+                                if (len != -1) {
+                                        fail("get value %d: %ld, expect -1", k, len);
+                                }
+                                continue;
+                        }
+                        long n = test_value(k, ref[k], expect);
+                        if (len != n || memcmp(value, expect, n) != 0) {
+                                fail("get value %d: length %ld, expect %ld", k, len, n);
+                        }
+                } else {
+                        long data = bplus_tree_get(tree, k);
+                        if (data != (present[k] ? ref[k] : -1)) {
+                                fail("get %d: %ld, expect %ld", k, data, present[k] ? ref[k] : -1);
+                        }
+                }
+        }
+        if (tree->flags & BPLUS_TREE_COUNTS) {
+                long rank = 0;
+                for (k = 0; k < TEST_KEYS; k++) {
+                        if (k % 97 == 0 && bplus_tree_rank(tree, k) != rank) {
+                                fail("rank %d: %ld, expect %ld", k, bplus_tree_rank(tree, k), rank);
+                        }
+                        rank += present[k];
+                }
+        }
+}
+
+/*
+插入或删除一个键值并更新参照，data为0时删除
+*/
+static void test_put(struct bplus_tree *tree, key_t key, long data)
+{
+        char value[300];
+        int ret;
+
+        if (data != 0 && (tree->flags & BPLUS_TREE_VLOG)) {
+                /*值日志模式下写入会覆盖已有的值*/
+                ret = bplus_tree_put_value(tree, key, value, test_value(key, data, value));
+                if (ret != 0) {
+                        fail("put value %d failed", key);
+                }
+                nkeys += !present[key];
+                present[key] = 1;
+                ref[key] = data;
+                return;
+        }
+        ret = bplus_tree_put(tree, key, data);
+        if (data != 0) {
+                if (present[key] ? ret != -1 : ret != 0) {
+                        fail("insert %d returns %d", key, ret);
+                }
+                if (!present[key]) {
+                        present[key] = 1;
+                        ref[key] = data;
+                        nkeys++;
+                }
+        } else {
+                if (present[key] ? ret != 0 : ret != -1) {
+                        fail("delete %d returns %d", key, ret);
+                }
+                if (present[key]) {
+                        present[key] = 0;
+                        nkeys--;
+                }
+        }
+}
+
+/*
+打开测试用的B+树，需要时建立布隆过滤器
+*/
+static struct bplus_tree *test_open(int block_size, int flags, int bloom)
+{
+        struct bplus_tree *tree = bplus_tree_init_flags(TEST_FILE, block_size, flags);
+        if (tree == NULL) {
+                fail("open %s failed", TEST_FILE);
+        }
+        if (bloom && tree->bloom == NULL) {
+                bplus_tree_bloom_build(tree, TEST_KEYS, 10);
+        }
+        return tree;
+}
+
+/*
+随机插入和删除，每5轮关闭后重新打开
+轮次按4取模：顺序插入、随机插入、随机插入、随机删除
+最后删除所有键值，树必须为空
+*/
+static void test_stress(const char *name, int block_size, int flags, int bloom, unsigned int seed, int rounds)
+{
+        int r, i;
+
+        test_unlink();
+        memset(present, 0, sizeof(present));
+        nkeys = 0;
+        srand(seed);
+
+        struct bplus_tree *tree = test_open(block_size, flags, bloom);
+        for (r = 0; r < rounds; r++) {
+                for (i = 0; i < 3000; i++) {
+                        key_t key = r % 4 == 0 ? (r * 3000 + i) % TEST_KEYS : rand() % TEST_KEYS;
+                        long data = (r % 4 == 3 || rand() % 3 == 0) ? 0 : rand() % 100000 + 1;
+                        test_put(tree, key, data);
+                }
+                if ((flags & BPLUS_TREE_VLOG) && r % 5 == 2) {
+                        bplus_tree_vlog_gc(tree);
+                }
+                test_validate(tree);
+                test_gets(tree);
+                if (r % 5 == 4) {
+                        bplus_tree_deinit(tree);
+                        tree = test_open(block_size, flags, bloom);
+                        test_validate(tree);
+                        test_gets(tree);
+                }
+        }
+        for (i = 0; i < TEST_KEYS; i++) {
+                test_put(tree, i, 0);
+        }
+        test_validate(tree);
+        bplus_tree_deinit(tree);
+        test_unlink();
+        printf("%-24s block %-5d ok\n", name, block_size);
+}
+
+/*
+值日志垃圾回收在替换之前中断：<vlog>.gc和<vlog>.old都存在，<vlog>仍是旧的值日志
+重新打开后两个文件被删除，所有的值不变
+*/
+static void test_vlog_recover(void)
+{
+        char name[1100], old[1100];
+        int fd, i;
+
+        test_unlink();
+        memset(present, 0, sizeof(present));
+        nkeys = 0;
+        srand(7);
+
+        struct bplus_tree *tree = test_open(1024, BPLUS_TREE_VLOG, 0);
+        for (i = 0; i < 6000; i++) {
+                test_put(tree, rand() % 2000, rand() % 3 == 0 ? 0 : rand() % 100000 + 1);
+        }
+        snprintf(name, sizeof(name), "%s.gc", tree->vlog_name);
+        snprintf(old, sizeof(old), "%s.old", tree->vlog_name);
+        fd = open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, "partial", 7) != 7 || link(tree->vlog_name, old) != 0) {
+                fail("cannot simulate interrupted gc");
+        }
+        close(fd);
+        bplus_tree_deinit(tree);
+
+        tree = test_open(1024, BPLUS_TREE_VLOG, 0);
+        if (access(name, F_OK) == 0 || access(old, F_OK) == 0) {
+                fail("interrupted gc files not removed");
+        }
+        test_validate(tree);
+        test_gets(tree);
+        bplus_tree_deinit(tree);
+        test_unlink();
+        printf("%-24s block %-5d ok\n", "vlog recover", 1024);
+}
+
+int main(int argc, char **argv)
+{
+        unsigned int seed = argc > 1 ? atoi(argv[1]) : 1;
+        int rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+        test_stress("plain", 256, 0, 0, seed, rounds);
+        test_stress("plain", 4096, 0, 0, seed, rounds);
+        test_stress("counts", 256, BPLUS_TREE_COUNTS, 0, seed, rounds);
+        test_stress("counts + bloom", 1024, BPLUS_TREE_COUNTS, 1, seed, rounds);
+        test_stress("vlog", 1024, BPLUS_TREE_VLOG, 0, seed, rounds);
+        test_vlog_recover();
+        printf("all tests passed\n");
+        return 0;
+}